@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) 2002 Jon Atkins http://www.jonatkins.com/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+
+//radioclkbench - times the decoding path on the edges in a capture file: the whole of
+//clkProcessStatusChange(), and clkPulseLength(), xxxDecode() and clkCalculatePPSAverage()
+//on their own. each is run with logging off, then with trace logging going to /dev/null.
+//"make bench" runs it on a day of radioclkgen signal from each station.
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "systime.h"
+
+#if HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "clock.h"
+#include "decode_dcf77.h"
+#include "decode_msf.h"
+#include "decode_wwvb.h"
+#include "capfile.h"
+#include "logger.h"
+#include "memory.h"
+#include "settings.h"
+
+
+#if !HAVE_STRCASECMP
+# if HAVE_STRICMP
+#  define strcasecmp(a,b) stricmp((a),(b))
+# else
+#  define strcasecmp(a,b) strcmpi((a),(b))
+# endif
+#endif
+
+
+//how many times each minute decode and average is repeated, per pass
+#define	BENCH_DECODE_REPEAT	(1000)
+#define	BENCH_AVERAGE_REPEAT	(20000)
+
+
+typedef struct
+{
+	time_f	timef;
+	int	status;
+} benchEdgeT;
+
+
+static int	benchClockType = CLOCKTYPE_DCF77;
+static int	benchLine = TIOCM_CD;
+static int	benchPasses = 5;
+
+static benchEdgeT*	benchEdges;
+static int		benchNumEdges;
+
+//results are stored here, so the compiler can't drop the calls
+static volatile int	benchSink;
+
+
+//-- measuring
+
+static int	benchInstrFd = -1;
+
+//count user-space instructions, if the kernel lets us
+static void
+benchOpenCounter (void)
+{
+#if HAVE_LINUX_PERF_EVENT_H
+	struct perf_event_attr	attr;
+
+	memset ( &attr, 0, sizeof(attr) );
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	benchInstrFd = syscall ( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+#endif
+}
+
+static long long
+benchInstructions (void)
+{
+	long long	count;
+
+	if ( benchInstrFd < 0 || read ( benchInstrFd, &count, sizeof(count) ) != sizeof(count) )
+		return -1;
+
+	return count;
+}
+
+typedef struct
+{
+	struct timespec	start;
+	long long	instr;
+	unsigned long	allocs;
+} benchMarkT;
+
+static void
+benchStart ( benchMarkT* mark )
+{
+	mark->allocs = safe_alloccount ();
+	mark->instr = benchInstructions ();
+	clock_gettime ( CLOCK_MONOTONIC, &mark->start );
+}
+
+//the time, instructions and allocations since benchStart(), per count ops
+static void
+benchStop ( benchMarkT* mark, const char* name, const char* logging, long count, const char* unit )
+{
+	struct timespec	now;
+	long long	instr;
+	double		ns;
+	char		instrbuf[32];
+
+	clock_gettime ( CLOCK_MONOTONIC, &now );
+	instr = benchInstructions ();
+
+	if ( count <= 0 )
+		count = 1;
+
+	ns = ( now.tv_sec - mark->start.tv_sec ) * 1e9 + ( now.tv_nsec - mark->start.tv_nsec );
+
+	if ( instr >= 0 && mark->instr >= 0 )
+		snprintf ( instrbuf, sizeof(instrbuf), "%.1f", (double)( instr - mark->instr ) / count );
+	else
+		strcpy ( instrbuf, "n/a" );
+
+	printf ( "%-16s %-6s %12.1f ns/%-7s %10s instr %8.4f allocs\n", name, logging,
+		ns / count, unit, instrbuf, (double)( safe_alloccount () - mark->allocs ) / count );
+}
+
+
+//-- the benchmarks
+
+static int
+benchDecode ( clkInfoT* clock, time_f minstart )
+{
+	switch ( benchClockType )
+	{
+	case CLOCKTYPE_MSF:
+		return msfDecode ( clock, minstart );
+	case CLOCKTYPE_WWVB:
+		return wwvbDecode ( clock, minstart );
+	case CLOCKTYPE_DCF77:
+	default:
+		return dcf77Decode ( clock, minstart );
+	}
+}
+
+static int
+benchEncode ( time_t minute, signed char* data )
+{
+	switch ( benchClockType )
+	{
+	case CLOCKTYPE_MSF:
+		return msfEncode ( minute, 0, data );
+	case CLOCKTYPE_WWVB:
+		return wwvbEncode ( minute, 0, data );
+	case CLOCKTYPE_DCF77:
+	default:
+		return dcf77Encode ( minute, 0, data );
+	}
+}
+
+//every edge through clkProcessStatusChange(), as the decoder thread does
+static void
+benchStatusChange ( const char* logging )
+{
+	benchMarkT	mark;
+	clkInfoT*	clock;
+	long		decoded;
+	int		pass, i;
+
+	decoded = 0;
+	benchStart ( &mark );
+
+	for ( pass=0; pass<benchPasses; pass++ )
+	{
+		//(a new clock each pass - these are never freed, there's no clkDestroy())
+		clock = clkCreate ( 0, 0, -1, SHM_PERM, NULL, 0.0, benchClockType );
+
+		for ( i=0; i<benchNumEdges; i++ )
+			clkProcessStatusChange ( clock, benchEdges[i].status, benchEdges[i].timef );
+
+		//(only whole minutes - the seconds that get the clock back in step set radiotime too)
+		decoded += clock->decodesfull + clock->decodespartial;
+	}
+
+	benchStop ( &mark, "status change", logging, (long)benchPasses * benchNumEdges, "edge" );
+	printf ( "%-16s %-6s %12ld minutes decoded per pass\n", "", logging, decoded / benchPasses );
+}
+
+static void
+benchPulseLength ( const char* logging )
+{
+	benchMarkT	mark;
+	int		pass, i, sum;
+
+	sum = 0;
+	benchStart ( &mark );
+
+	for ( pass=0; pass<benchPasses; pass++ )
+	{
+		for ( i=1; i<benchNumEdges; i++ )
+			sum += clkPulseLength ( benchEdges[i].timef - benchEdges[i-1].timef, benchClockType );
+	}
+
+	benchStop ( &mark, "pulse length", logging, (long)benchPasses * ( benchNumEdges - 1 ), "pulse" );
+	benchSink = sum;
+}
+
+//xxxDecode() on the data[] it would have at the end of each of 60 minutes
+static void
+benchMinuteDecode ( const char* logging )
+{
+	signed char	data[60][CLK_ENCODE_MAX];
+	benchMarkT	mark;
+	clkInfoT*	clock;
+	time_t		first;
+	long		count, ok;
+	int		m, r;
+
+	first = (time_t)benchEdges[0].timef;
+	first -= first % 60;
+	for ( m=0; m<60; m++ )
+		benchEncode ( first + m*60, data[m] );
+
+	clock = clkCreate ( 0, 0, -1, SHM_PERM, NULL, 0.0, benchClockType );
+	count = 0;
+	ok = 0;
+
+	benchStart ( &mark );
+
+	for ( r=0; r<BENCH_DECODE_REPEAT*benchPasses/60; r++ )
+	{
+		for ( m=0; m<60; m++ )
+		{
+			memcpy ( clock->data, data[m], 60 );
+			clock->numdata = 60;
+
+			if ( benchDecode ( clock, first + m*60 + 60 ) >= 0 )
+				ok++;
+			count++;
+		}
+	}
+
+	benchStop ( &mark, "minute decode", logging, count, "minute" );
+
+	if ( ok != count )
+		printf ( "%-16s %-6s %12ld of %ld minutes failed to decode\n", "", logging, count - ok, count );
+}
+
+static void
+benchPPSAverage ( const char* logging )
+{
+	benchMarkT	mark;
+	clkInfoT*	clock;
+	time_f		average, maxerr;
+	int		i, r, sum;
+
+	clock = clkCreate ( 0, 0, -1, SHM_PERM, NULL, 0.0, benchClockType );
+
+	//a minute of seconds with a few ms of scatter
+	for ( i=0; i<clock->ppswindow; i++ )
+		clkAddPPSOffset ( clock, 0.0005 * ( (i*37) % 11 - 5 ) );
+
+	sum = 0;
+	benchStart ( &mark );
+
+	for ( r=0; r<BENCH_AVERAGE_REPEAT*benchPasses; r++ )
+		sum += clkCalculatePPSAverage ( clock, &average, &maxerr );
+
+	benchStop ( &mark, "pps average", logging, (long)BENCH_AVERAGE_REPEAT * benchPasses, "call" );
+	benchSink = sum;
+}
+
+static void
+benchRun ( const char* logging )
+{
+	benchStatusChange ( logging );
+	benchPulseLength ( logging );
+	benchMinuteDecode ( logging );
+	benchPPSAverage ( logging );
+}
+
+
+//-- loading the capture
+
+//the edges for the first device in the capture, on benchLine
+static int
+benchLoad ( char* filename )
+{
+	FILE*		file;
+	capRecordT	rec;
+	int		dev, size, ret, status;
+
+	if ( strcmp ( filename, "-" ) == 0 )
+		file = stdin;
+	else
+		file = fopen ( filename, "rb" );
+
+	if ( file == NULL || capReadHeader ( file ) < 0 )
+		return -1;
+
+	dev = -1;
+	size = 0;
+	status = -1;
+
+	while ( (ret = capReadRecord ( file, &rec )) > 0 )
+	{
+		if ( rec.type == CAP_DEVICE && dev < 0 )
+			dev = rec.index;
+
+		if ( rec.type != CAP_EDGE || rec.index != dev )
+			continue;
+
+		//captures store every change on the device - keep the ones on our line
+		if ( ( (rec.lines & benchLine) != 0 ) == status )
+			continue;
+		status = ( (rec.lines & benchLine) != 0 );
+
+		if ( benchNumEdges >= size )
+		{
+			size = size ? size*2 : 4096;
+			benchEdges = realloc ( benchEdges, size * sizeof(benchEdgeT) );
+			if ( benchEdges == NULL )
+				return -1;
+		}
+
+		benchEdges[benchNumEdges].timef = rec.timef;
+		benchEdges[benchNumEdges].status = status;
+		benchNumEdges++;
+	}
+
+	if ( file != stdin )
+		fclose ( file );
+
+	return ret;
+}
+
+
+void
+usage (void)
+{
+	printf (
+"Usage: radioclkbench [ -t dcf77|msf|wwvb ] [ -l dcd|cts|dsr|rng ] [ -p passes ] capture\n"
+"   -t: the radio station (default dcf77)\n"
+"   -l: the line the clock is on (default dcd)\n"
+"   -p passes: how many times to go through the edges (default 5)\n"
+"   the capture is from radioclkd2 -c or radioclkgen (- for stdin)\n"
+"   instructions are counted with perf events, where the kernel allows it\n"
+"   eg: radioclkgen -t msf -n 1440 -j 1 | radioclkbench -t msf -\n"
+	);
+
+	exit(1);
+}
+
+int
+main ( int argc, char** argv )
+{
+	char*	arg;
+	char*	parm;
+	FILE*	devnull;
+
+	//skip the program name
+	argc--;
+	argv++;
+
+	while ( argc > 0 && argv[0][0] == '-' && argv[0][1] != 0 )
+	{
+		arg = argv[0];
+
+		if ( strlen(arg) > 2 )
+		{
+			parm = arg + 2;
+		}
+		else
+		{
+			argc--;
+			argv++;
+			if ( argc == 0 )
+				usage();
+			parm = argv[0];
+		}
+
+		switch ( arg[1] )
+		{
+		case 't':
+			if ( strcasecmp ( parm, "dcf77" ) == 0 )
+				benchClockType = CLOCKTYPE_DCF77;
+			else if ( strcasecmp ( parm, "msf" ) == 0 )
+				benchClockType = CLOCKTYPE_MSF;
+			else if ( strcasecmp ( parm, "wwvb" ) == 0 )
+				benchClockType = CLOCKTYPE_WWVB;
+			else
+				usage();
+			break;
+
+		case 'l':
+			if ( strcasecmp ( parm, "dcd" ) == 0 )
+				benchLine = TIOCM_CD;
+			else if ( strcasecmp ( parm, "cts" ) == 0 )
+				benchLine = TIOCM_CTS;
+			else if ( strcasecmp ( parm, "dsr" ) == 0 )
+				benchLine = TIOCM_DSR;
+			else if ( strcasecmp ( parm, "rng" ) == 0 )
+				benchLine = TIOCM_RNG;
+			else
+				usage();
+			break;
+
+		case 'p':
+			benchPasses = atoi ( parm );
+			if ( benchPasses < 1 )
+				usage();
+			break;
+
+		default:
+			usage();
+			break;
+		}
+
+		argc--;
+		argv++;
+	}
+
+	if ( argc != 1 )
+		usage();
+
+	if ( benchLoad ( argv[0] ) < 0 || benchNumEdges < 2 )
+	{
+		fprintf ( stderr, "Error: no edges read from '%s'\n", argv[0] );
+		exit(1);
+	}
+
+	//no shared memory - clkSendTime() does everything but the shmStore()
+	debugLevel = 1;
+
+	benchOpenCounter ();
+
+	printf ( "%s: %d edges, %d passes\n", argv[0], benchNumEdges, benchPasses );
+
+	loggerSetFile ( NULL, 0 );
+	loggerSyslog ( 0, 0 );
+	benchRun ( "off" );
+
+	devnull = fopen ( "/dev/null", "w" );
+	if ( devnull != NULL )
+	{
+		loggerSetFile ( devnull, LOGGER_TRACE );
+		benchRun ( "trace" );
+		loggerSetFile ( NULL, 0 );
+		fclose ( devnull );
+	}
+
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2002 Jon Atkins http://www.jonatkins.com/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "capfile.h"
+
+
+static const unsigned char capMagic[8] = { 'R', 'C', 'L', 'K', 'D', '2', 'R', 1 };
+
+
+//-- little-endian fields
+
+static void
+capPut ( unsigned char* buf, uint64_t val, int len )
+{
+	int	i;
+
+	for ( i=0; i<len; i++ )
+		buf[i] = (unsigned char)(val >> (8*i));
+}
+
+static uint64_t
+capGet ( const unsigned char* buf, int len )
+{
+	uint64_t	val;
+	int		i;
+
+	val = 0;
+	for ( i=len-1; i>=0; i-- )
+		val = (val << 8) | buf[i];
+
+	return val;
+}
+
+
+int
+capWriteHeader ( FILE* file )
+{
+	if ( fwrite ( capMagic, sizeof(capMagic), 1, file ) != 1 )
+		return -1;
+
+	return 0;
+}
+
+int
+capWriteDevice ( FILE* file, int index, const char* name )
+{
+	unsigned char	buf[3+255];
+	int		len;
+
+	len = strlen ( name );
+	if ( index < 0 || index >= CAP_MAX_DEVS || len > 255 )
+		return -1;
+
+	buf[0] = CAP_DEVICE;
+	buf[1] = index;
+	buf[2] = len;
+	memcpy ( buf+3, name, len );
+
+	if ( fwrite ( buf, 3+len, 1, file ) != 1 )
+		return -1;
+
+	return 0;
+}
+
+int
+capWriteEdge ( FILE* file, int index, int lines, time_f timef )
+{
+	unsigned char	buf[18];
+	int64_t		sec;
+	uint32_t	nsec;
+
+	sec = (int64_t)floor ( timef );
+	nsec = (uint32_t)((timef - sec) * 1000000000.0 + 0.5);
+	if ( nsec >= 1000000000 )
+	{
+		sec++;
+		nsec -= 1000000000;
+	}
+
+	buf[0] = CAP_EDGE;
+	buf[1] = index;
+	capPut ( buf+2, (uint32_t)lines, 4 );
+	capPut ( buf+6, (uint64_t)sec, 8 );
+	capPut ( buf+14, nsec, 4 );
+
+	if ( fwrite ( buf, sizeof(buf), 1, file ) != 1 )
+		return -1;
+
+	return 0;
+}
+
+
+int
+capReadHeader ( FILE* file )
+{
+	unsigned char	magic[sizeof(capMagic)];
+
+	if ( fread ( magic, sizeof(magic), 1, file ) != 1 || memcmp ( magic, capMagic, sizeof(magic) ) != 0 )
+		return -1;
+
+	return 0;
+}
+
+int
+capReadRecord ( FILE* file, capRecordT* rec )
+{
+	unsigned char	buf[18];
+	int		len;
+
+	if ( fread ( buf, 2, 1, file ) != 1 )
+		return 0;
+
+	rec->type = buf[0];
+	rec->index = buf[1];
+	if ( rec->index >= CAP_MAX_DEVS )
+		return -1;
+
+	switch ( rec->type )
+	{
+	case CAP_DEVICE:
+		if ( fread ( buf+2, 1, 1, file ) != 1 )
+			return -1;
+		len = buf[2];
+		if ( len > 0 && fread ( rec->name, len, 1, file ) != 1 )
+			return -1;
+		rec->name[len] = 0;
+		return 1;
+
+	case CAP_EDGE:
+		if ( fread ( buf+2, 16, 1, file ) != 1 )
+			return -1;
+		rec->lines = (int)(uint32_t)capGet ( buf+2, 4 );
+		rec->timef = (time_f)(int64_t)capGet ( buf+6, 8 ) + (time_f)capGet ( buf+14, 4 ) / (time_f)1000000000.0;
+		return 1;
+	}
+
+	return -1;
+}
@@ -0,0 +1,39 @@
+#ifndef CAPFILE_H_
+#define CAPFILE_H_
+
+#include <stdio.h>
+#include "timef.h"
+
+
+//the capture file format, shared by -c/-s replay (record.c) and the generator.
+//
+//the file is the magic "RCLKD2R\1", then records (all little-endian):
+//  'D' index(1) length(1) name(length)	- a device, before its first change
+//  'E' index(1) lines(4) sec(8) nsec(4)	- the lines on a device changed at sec.nsec
+
+#define	CAP_MAX_DEVS	(32)
+
+#define	CAP_DEVICE	('D')
+#define	CAP_EDGE	('E')
+
+typedef struct
+{
+	int	type;		//CAP_DEVICE or CAP_EDGE
+	int	index;		//the device
+	char	name[256];	//CAP_DEVICE
+	int	lines;		//CAP_EDGE
+	time_f	timef;
+} capRecordT;
+
+
+int capWriteHeader ( FILE* file );
+int capWriteDevice ( FILE* file, int index, const char* name );
+int capWriteEdge ( FILE* file, int index, int lines, time_f timef );
+
+//returns -1 if this isn't a capture file
+int capReadHeader ( FILE* file );
+//returns 1 for a record, 0 at the end of the file, or -1 for a bad record
+int capReadRecord ( FILE* file, capRecordT* rec );
+
+
+#endif
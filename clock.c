@@ -25,6 +25,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 
@@ -37,12 +38,24 @@
 #include "decode_wwvb.h"
 
 #include "shm.h"
+#include "discipline.h"
 #include "logger.h"
 #include "settings.h"
+#include "utctime.h"
 
 
 static clkInfoT* clkListHead;
 
+//-F: the clocks that agree are combined onto here, once a minute
+static shmTimeT* clkFuseShm;
+static time_t clkFuseMinute;
+
+static void clkPulseInit ( clkPulseClassT* class, int clocktype );
+static int clkPulseClassify ( const clkPulseClassT* class, time_f timef );
+static void clkPulseLearn ( clkPulseClassT* class, time_f timef, int val );
+static void clkLockLost ( clkInfoT* clock );
+static void clkLockCheck ( clkInfoT* clock );
+
 
 void
 clkDumpData ( const clkInfoT* clock )
@@ -59,9 +72,10 @@ clkDumpData ( const clkInfoT* clock )
 
 
 clkInfoT*
-clkCreate ( int inverted, int shmunit, time_f fudgeoffset, int clocktype )
+clkCreate ( int inverted, int shmunit, int shmkey, int shmperm, const char* sockpath, time_f fudgeoffset, int clocktype )
 {
 	clkInfoT*	clkinfo;
+	int		keybase;
 
 	clkinfo = safe_mallocz ( sizeof(clkInfoT) );
 	clkinfo->next = clkListHead;
@@ -73,8 +87,37 @@ clkCreate ( int inverted, int shmunit, time_f fudgeoffset, int clocktype )
 	clkinfo->numdata = 0;
 	clkinfo->clocktype=clocktype;
 
+	clkPulseInit ( &clkinfo->pulses, clocktype );
+	clkPulseInit ( &clkinfo->clears, clocktype );
+
+	clkinfo->ppswindow = ppsWindow;
+	clkinfo->ppsoffsets = safe_mallocz ( clkinfo->ppswindow * sizeof(time_f) );
+	clkinfo->ppssorted = safe_mallocz ( clkinfo->ppswindow * sizeof(time_f) );
+
+	//the other units are at the same offset from the clock's key, with its permissions
+	//(the first clock's, for the combined unit)
+	keybase = ( shmkey >= 0 ) ? shmkey - shmunit : SHM_KEY;
+
 	if ( !debugLevel )
-		clkinfo->shm = shmCreate ( shmunit );
+		clkinfo->shm = shmCreate ( keybase + shmunit, shmperm );
+	if ( !debugLevel && shmPpsUnit >= 0 )
+	{
+		clkinfo->ppsshm = shmCreate ( keybase + shmPpsUnit + shmunit, shmperm );
+		if ( clkinfo->ppsshm == NULL )
+			loggerf ( LOGGER_NOTE, "Error: failed to create the pps shared memory unit %d\n", shmPpsUnit + shmunit );
+	}
+	if ( !debugLevel && shmFuseUnit >= 0 && clkFuseShm == NULL )
+	{
+		clkFuseShm = shmCreate ( keybase + shmFuseUnit, shmperm );
+		if ( clkFuseShm == NULL )
+			loggerf ( LOGGER_NOTE, "Error: failed to create the combined shared memory unit %d\n", shmFuseUnit );
+	}
+	if ( !debugLevel && sockpath != NULL )
+	{
+		clkinfo->sock = sockCreate ( sockpath );
+		if ( clkinfo->sock == NULL )
+			loggerf ( LOGGER_NOTE, "Error: failed to create a socket for chronyd at '%s'\n", sockpath );
+	}
 
 	return clkinfo;
 }
@@ -83,65 +126,358 @@ void
 clkDataClear ( clkInfoT* clock )
 {
 	clock->numdata = 0;
+	clock->minutesync = 0;
+}
+
+//pulse/clear lengths for each radio clock
+//  (note: the last 2 dcf77 lengths are to handle the missing second 59)
+static const time_f dcf77lengths[] = { 0.1, 0.2, 0.8, 0.9, 1.8, 1.9, -1.0 };
+static const time_f msflengths[] = { 0.1, 0.2, 0.3, 0.5, 0.7, 0.8, 0.9, -1.0 };
+static const time_f wwvblengths[] = { 0.2, 0.5, 0.8, -1.0 };
+
+//how far a length can be from the one learned, by its deviation - but at least this
+//(the station's lengths start out at +-40ms)...
+#define	CLK_PULSE_DEVIATIONS	(4.0)
+#define	CLK_PULSE_MINWIDTH	(0.030)
+#define	CLK_PULSE_MAXWIDTH	(0.070)
+#define	CLK_PULSE_STARTDEV	(0.010)
+//...and how far the learned length can move from the station's
+#define	CLK_PULSE_MAXBIAS	(0.080)
+//each length moves the learned one 1/this of the way, and the table is rebuilt after this many
+#define	CLK_PULSE_LEARN		(16)
+
+static clkPulseClassT clkPulseNominal[3];
+
+
+//fill in the table from the learned lengths - each length has the slots close enough to
+//it, up to half way to the next one (the station's lengths are in order)
+static void
+clkPulseBuild ( clkPulseClassT* class )
+{
+	time_f	width, lo, hi;
+	int	slot, last, i;
+
+	memset ( class->table, -1, sizeof(class->table) );
+
+	for ( i=0; i<class->classes; i++ )
+	{
+		width = CLK_PULSE_DEVIATIONS * class->dev[i];
+		if ( width < CLK_PULSE_MINWIDTH )
+			width = CLK_PULSE_MINWIDTH;
+		if ( width > CLK_PULSE_MAXWIDTH )
+			width = CLK_PULSE_MAXWIDTH;
+
+		lo = class->mean[i] - width;
+		hi = class->mean[i] + width;
+		if ( i > 0 && lo < ( class->mean[i-1] + class->mean[i] ) / 2 )
+			lo = ( class->mean[i-1] + class->mean[i] ) / 2;
+		if ( i < class->classes-1 && hi > ( class->mean[i] + class->mean[i+1] ) / 2 )
+			hi = ( class->mean[i] + class->mean[i+1] ) / 2;
+
+		slot = (int)ceil ( lo / CLK_PULSE_STEP );
+		last = (int)ceil ( hi / CLK_PULSE_STEP ) - 1;
+		if ( slot < 0 )
+			slot = 0;
+		if ( last > CLK_PULSE_SLOTS-2 )	//anything longer lands on the last slot
+			last = CLK_PULSE_SLOTS-2;
+
+		for ( ; slot<=last; slot++ )
+			class->table[slot] = (int)( class->nominal[i] * 10 + 0.5 );	//to convert to 10ths of a second
+	}
+
+	class->learned = 0;
+}
+
+static void
+clkPulseInit ( clkPulseClassT* class, int clocktype )
+{
+	const time_f* lengths;
+	int	i;
+
+	switch ( clocktype )
+	{
+	case CLOCKTYPE_MSF:
+		lengths = msflengths;
+		break;
+	case CLOCKTYPE_WWVB:
+		lengths = wwvblengths;
+		break;
+	case CLOCKTYPE_DCF77:
+	default:
+		lengths = dcf77lengths;
+		break;
+	}
+
+	for ( i=0; lengths[i] > 0 && i < CLK_PULSE_CLASSES; i++ )
+	{
+		class->nominal[i] = lengths[i];
+		class->mean[i] = lengths[i];
+		class->dev[i] = CLK_PULSE_STARTDEV;
+	}
+	class->classes = i;
+
+	clkPulseBuild ( class );
+}
+
+//the length (in 10ths) of a pulse or clear, or -1 - no branches, just the table
+static int
+clkPulseClassify ( const clkPulseClassT* class, time_f timef )
+{
+	unsigned int	slot;
+
+	timef = timef > 0 ? timef : 0;
+	timef = timef < CLK_PULSE_SLOTS*CLK_PULSE_STEP ? timef : CLK_PULSE_SLOTS*CLK_PULSE_STEP;
+
+	slot = (unsigned int)( timef * (1.0/CLK_PULSE_STEP) + 0.5 );
+	slot = slot < CLK_PULSE_SLOTS ? slot : CLK_PULSE_SLOTS-1;
+
+	return class->table[slot];
+}
+
+//a length has been classified as val - move the length learned for it towards this one.
+//if it wasn't classified (val -1), the nearest of the station's lengths is moved towards it
+//more slowly, if it's close enough - so a receiver that is further out than +-40ms is learned
+//too (up to half way to the next length)
+static void
+clkPulseLearn ( clkPulseClassT* class, time_f timef, int val )
+{
+	time_f	err;
+	int	i, c;
+
+	i = -1;
+	for ( c=0; c<class->classes; c++ )
+	{
+		if ( val >= 0 ? (int)( class->nominal[c] * 10 + 0.5 ) == val
+			: ( i < 0 || fabs ( timef - class->nominal[c] ) < fabs ( timef - class->nominal[i] ) ) )
+			i = c;
+	}
+	if ( i < 0 || fabs ( timef - class->nominal[i] ) >= CLK_PULSE_MAXBIAS )
+		return;
+
+	err = timef - class->mean[i];
+	if ( val < 0 )
+		class->mean[i] += err / ( CLK_PULSE_LEARN*4 );
+	else
+	{
+		class->mean[i] += err / CLK_PULSE_LEARN;
+		class->dev[i] += ( fabs ( err ) - class->dev[i] ) / CLK_PULSE_LEARN;
+	}
+
+	if ( class->mean[i] > class->nominal[i] + CLK_PULSE_MAXBIAS )
+		class->mean[i] = class->nominal[i] + CLK_PULSE_MAXBIAS;
+	if ( class->mean[i] < class->nominal[i] - CLK_PULSE_MAXBIAS )
+		class->mean[i] = class->nominal[i] - CLK_PULSE_MAXBIAS;
+
+	if ( ++class->learned >= CLK_PULSE_LEARN )
+		clkPulseBuild ( class );
 }
 
 int
 clkPulseLength ( time_f timef, int clocktype )
 {
-        //only detect short pulses...
-        if ( timef > 2.0 )
-                return -1;
-
-	//pulse/clear lengths for each radio clock
-	time_f* lengths;
-
-        switch (clocktype) {
-        case CLOCKTYPE_DCF77:
-            //  (note: these last 2 are to handle the missing second 59)
-            lengths = (time_f[]){ 0.1, 0.2, 0.8, 0.9, 1.8, 1.9, -1.0 };
-            break;
-        case CLOCKTYPE_MSF:
-            lengths = (time_f[]){ 0.1, 0.2, 0.3, 0.5, 0.7, 0.8, 0.9, -1.0 };
-            break;
-        case CLOCKTYPE_WWVB:
-            lengths = (time_f[]){ 0.2, 0.5, 0.8, -1.0 };
-            break;
-        }
+	clkPulseClassT*	class;
+
+	//the station's own lengths, +-40ms
+	class = &clkPulseNominal[ clocktype >= 0 && clocktype < 3 ? clocktype : CLOCKTYPE_DCF77 ];
+	if ( class->classes == 0 )
+		clkPulseInit ( class, clocktype );
+
+	return clkPulseClassify ( class, timef );
+}
+
+
+//-- diversity (-G)
+
+//seconds received by clocks in a group this close together (after their fudges) are the same
+#define	CLK_DIVERSITY_MATCH	(0.25)
+//the quality of an erased second - any received one is better
+#define	CLK_DIVERSITY_WORST	(1e9)
+
+//how far a length classified as val is from the one learned for it, in deviations
+static time_f
+clkPulseQuality ( const clkPulseClassT* class, time_f timef, int val )
+{
+	int	c;
 
+	for ( c=0; c<class->classes; c++ )
+	{
+		if ( (int)( class->nominal[c] * 10 + 0.5 ) == val )
+			return fabs ( timef - class->mean[c] ) / ( class->dev[c] > CLK_PULSE_STEP ? class->dev[c] : CLK_PULSE_STEP );
+	}
+
+	return CLK_DIVERSITY_WORST;
+}
+
+//the second that started at timef now reads val - a second pulse in the same second (the MSF
+//B bit, or a bad one) changes it, and is only as good as the worse of the two
+static void
+clkDiversityStore ( clkInfoT* clock, time_f timef, int val, time_f quality )
+{
+	int	last;
+
+	if ( !clock->group )
+		return;
+
+	last = ( clock->divindex + CLK_DIVERSITY_SECONDS-1 ) % CLK_DIVERSITY_SECONDS;
+	if ( clock->divtime[last] != 0 && fabs ( timef - clock->divtime[last] ) < 0.5 )
+	{
+		clock->divval[last] = val;
+		if ( quality > clock->divquality[last] )
+			clock->divquality[last] = quality;
+		return;
+	}
+
+	clock->divtime[clock->divindex] = timef;
+	clock->divval[clock->divindex] = val;
+	clock->divquality[clock->divindex] = quality;
+	clock->divindex = ( clock->divindex + 1 ) % CLK_DIVERSITY_SECONDS;
+}
+
+//the second a clock received at timef - its value, or -2 if it has none
+static int
+clkDiversityFind ( const clkInfoT* clock, time_f timef, time_f* pquality )
+{
 	int	i;
 
-	for ( i=0; lengths[i] > 0; i++ )
+	for ( i=0; i<CLK_DIVERSITY_SECONDS; i++ )
 	{
-		if ( timef > (lengths[i]-0.040) && timef < (lengths[i]+0.040) )
-			return (int)(lengths[i] * 10 + 0.5);	//to convert to 10ths of a second
+		if ( clock->divtime[i] != 0 && fabs ( clock->divtime[i] - timef ) < CLK_DIVERSITY_MATCH )
+		{
+			*pquality = clock->divval[i] == CLK_DATA_ERASED ? CLK_DIVERSITY_WORST : clock->divquality[i];
+			return clock->divval[i];
+		}
 	}
-	return -1;
+
+	return -2;
 }
 
+//a minute that started at minstart is about to be decoded - each second is taken from
+//another clock in the group if that one received it better (the length closer to the one it
+//learned), or if it's erased here. Each second in data[] started a whole second apart, up
+//to minstart
+static void
+clkDiversity ( clkInfoT* clock, time_f minstart )
+{
+	clkInfoT*	c;
+	time_f		when, best, quality;
+	int		filled, bestval, val, i;
+
+	filled = 0;
+	for ( i=0; i<clock->numdata; i++ )
+	{
+		when = minstart - ( clock->numdata - i );
+
+		//(a second this clock has no record of, but has a value for, is kept - it was
+		//filled in from the minute before)
+		if ( clkDiversityFind ( clock, when, &best ) == -2 )
+			best = clock->data[i] == CLK_DATA_ERASED ? CLK_DIVERSITY_WORST : -1;
+
+		bestval = -2;
+		for ( c = clkListHead; c != NULL; c = c->next )
+		{
+			if ( c == clock || c->group != clock->group || c->clocktype != clock->clocktype )
+				continue;
+
+			val = clkDiversityFind ( c, when - clock->fudgeoffset + c->fudgeoffset, &quality );
+			if ( val != -2 && val != CLK_DATA_ERASED && quality < best )
+			{
+				best = quality;
+				bestval = val;
+			}
+		}
+
+		if ( bestval != -2 && bestval != clock->data[i] )
+		{
+			loggerf ( LOGGER_TRACE, "clock: second %d is %d from another receiver, not %d\n", i, bestval, clock->data[i] );
+			clock->data[i] = bestval;
+			filled++;
+		}
+	}
+
+	if ( filled > 0 )
+		loggerf ( LOGGER_DEBUG, "clock: %d seconds taken from the other receivers in group %d\n", filled, clock->group );
+	clock->divfilled += filled;
+}
+
+
+//a minute starting at minstart decoded (ret 0), or failed to (-1) - counted by whether it
+//had all its seconds
+static int
+clkCountDecode ( clkInfoT* clock, int ret, time_f minstart )
+{
+	int	whole;
+
+	whole = clock->numdata >= 59 && !clkDataErased ( clock, 0, 60 );
+
+	if ( ret < 0 && whole )
+		clock->failinvalid++;
+	else if ( ret < 0 )
+		clock->failshort++;
+	else
+	{
+		if ( whole )
+			clock->decodesfull++;
+		else
+			clock->decodespartial++;
+
+		if ( clock->firstdecode == 0 )
+			clock->firstdecode = minstart;
+		clock->lastdecode = minstart;
+	}
+
+	return ret;
+}
 
 void
 clkProcessStatusChange ( clkInfoT* clock, int status, time_f timef )
 {
 	time_f diff;
-	int	val;
+	int	val, missing, i;
 
 
 	if ( clock->inverted )
 		status = !status;
 
+	clock->edges++;
+	if ( clock->firstedge == 0 )
+		clock->firstedge = timef;
+
 //	timersub ( tv, &clock->changetime, &diff );
 	diff = timef - clock->changetime;
 
 	if ( !clock->status && status )
 	{
-		val = clkPulseLength ( diff, clock->clocktype );
+		val = clkPulseClassify ( &clock->pulses, diff );
+		clkPulseLearn ( &clock->pulses, diff, val );
+
+		if ( val < 0 && diff < clock->pulses.nominal[0] )
+			clock->badshort++;
+		else if ( val < 0 )
+			clock->badlong++;
+
 
+		if ( val < 0 && diff > 0 && diff < 1.0 )
+		{
+			//the pulse is there, but unreadable - only its second is lost, as an erasure
+			//(the decoders can fill in its field from the minutes before)
+			loggerf ( LOGGER_TRACE, "warning: bad pulse length "TIMEF_FORMAT" - erased\n", diff );
+
+			if ( clock->numdata >= 120 )
+				clkDataClear ( clock );
 
-		if ( val < 0 )
+			if ( clock->msf_skip_b && clock->numdata >= 1 )
+				clock->data[clock->numdata-1] = CLK_DATA_ERASED;
+			else
+				clock->data[ clock->numdata++ ] = CLK_DATA_ERASED;
+			clock->msf_skip_b = 0;
+			clkDiversityStore ( clock, clock->changetime, CLK_DATA_ERASED, CLK_DIVERSITY_WORST );
+		}
+		else if ( val < 0 )
 		{
 			loggerf ( LOGGER_TRACE, "warning: bad pulse length "TIMEF_FORMAT"\n", diff );
 
 			clkDataClear ( clock );
+			clkLockLost ( clock );
 		}
 		else
 		{
@@ -153,20 +489,27 @@ clkProcessStatusChange ( clkInfoT* clock, int status, time_f timef )
 			{
 				clock->msf_skip_b = 0;
 				if ( clock->numdata >= 1 )
+				{
 					clock->data[clock->numdata-1] += 10;
+					clkDiversityStore ( clock, clock->changetime, clock->data[clock->numdata-1], clkPulseQuality ( &clock->pulses, diff, val ) );
+				}
+				clock->lockval += 10;
 			}
 			else
 			{
 				if ( val == 5 && clock->clocktype==CLOCKTYPE_MSF )  //MSF minute marker...
 				{
+					if ( clock->group )
+						clkDiversity ( clock, clock->changetime );
 					clkDumpData ( clock );
-					if ( msfDecode ( clock, clock->changetime ) < 0 )
+					if ( clkCountDecode ( clock, msfDecode ( clock, clock->changetime ), clock->changetime ) < 0 )
 						loggerf ( LOGGER_DEBUG, "warning: failed to decode MSF time\n" );
 					else
 						clkSendTime ( clock );
 
 
 					clkDataClear ( clock );
+					clock->minutesync = 1;
 				}
 				if ( val == 8 && 
                                      clock->clocktype == CLOCKTYPE_WWVB &&
@@ -179,16 +522,24 @@ clkProcessStatusChange ( clkInfoT* clock, int status, time_f timef )
                                         end of the previous minute. Strangely, they send the On-Time-Marker, and
                                         then the time.
                                     */
+					if ( clock->group )
+						clkDiversity ( clock, clock->changetime );
 					clkDumpData ( clock );
-					if ( wwvbDecode ( clock, clock->changetime ) < 0 )
+					if ( clkCountDecode ( clock, wwvbDecode ( clock, clock->changetime ), clock->changetime ) < 0 )
 						loggerf ( LOGGER_DEBUG, "warning: failed to decode WWVB time\n" );
 					else
 						clkSendTime ( clock );
 
 					clkDataClear ( clock );
+					clock->minutesync = 1;
 				}
 
 				clock->data[ clock->numdata++ ] = val;
+				clkDiversityStore ( clock, clock->changetime, val, clkPulseQuality ( &clock->pulses, diff, val ) );
+
+				//checked when the second ends
+				clock->lockval = val;
+				clock->lockvaltime = clock->changetime;
 			}
 
 			if ( clock->numdata > 0 )
@@ -204,13 +555,35 @@ clkProcessStatusChange ( clkInfoT* clock, int status, time_f timef )
 		loggerf ( LOGGER_TRACE, "pulse start: at "TIMEF_FORMAT"\n", timef );
 
 
-		val = clkPulseLength ( diff, clock->clocktype );
+		val = clkPulseClassify ( &clock->clears, diff );
+		clkPulseLearn ( &clock->clears, diff, val );
+
+		//whole seconds with no pulse at all (a dropped pulse makes the DCF77 minute gap) -
+		//while the data is in step with the minute, they can be erased rather than losing it
+		missing = 0;
+		if ( val < 0 && diff > 1.0 && diff < CLK_MAX_MISSING+1 )
+			missing = (int)diff;
+		else if ( ( val == 18 || val == 19 ) && clock->numdata < 59 )
+			missing = 1;
+
+		if ( missing > 0 && clock->minutesync && clock->numdata + missing <= 59 )
+		{
+			clkLockCheck ( clock );
+
+			loggerf ( LOGGER_TRACE, "warning: %d seconds missing before "TIMEF_FORMAT" - erased\n", missing, timef );
+
+			for ( i=0; i<missing; i++ )
+				clock->data[ clock->numdata++ ] = CLK_DATA_ERASED;
+			clock->msf_skip_b = 0;
 
-		if ( val < 0 )
+			clkProcessPPS ( clock, timef );
+		}
+		else if ( val < 0 )
 		{
 			loggerf ( LOGGER_TRACE, "warning: bad clear length "TIMEF_FORMAT"\n", diff );
 
 			clkDataClear ( clock );
+			clkLockLost ( clock );
 		}
 		else if ( (clock->numdata > 1) && (clock->data[clock->numdata-1] == 1) && (val == 1) )
 		{
@@ -219,22 +592,28 @@ clkProcessStatusChange ( clkInfoT* clock, int status, time_f timef )
 		}
 		else if ( val == 18 || val == 19 )
 		{
+			clkLockCheck ( clock );
+
 			clock->data[clock->numdata++] = 0;	//store the missing second 59 value
 
+			if ( clock->group )
+				clkDiversity ( clock, timef );
 			clkDumpData ( clock );
 
-			if ( dcf77Decode ( clock, timef ) < 0 )
+			if ( clkCountDecode ( clock, dcf77Decode ( clock, timef ), timef ) < 0 )
 				loggerf ( LOGGER_DEBUG, "Warning: failed to decode DCF77\n" );
 			else
 				clkSendTime ( clock );
 
 
 			clkDataClear ( clock );
+			clock->minutesync = 1;
 
 		}
 		else
 		{
 			//we have the start of a second here...
+			clkLockCheck ( clock );
 
 //printf ( "\a" ); flush ( stdout );
 
@@ -253,126 +632,771 @@ clkProcessStatusChange ( clkInfoT* clock, int status, time_f timef )
 	//else no change so ignore pulse (should never happen)
 }
 
+void
+clkProcessErasure ( clkInfoT* clock, int status, int missed, time_f timef )
+{
+	int	i;
+
+	if ( clock->inverted )
+		status = !status;
+
+	clock->missededges += missed;
+
+	//the pulse that was being timed is wrong, and each pair of missed edges is another
+	//lost pulse - mark them as erased, rather than merging them into a bad pulse length
+	loggerf ( LOGGER_TRACE, "warning: %d edges missed before "TIMEF_FORMAT"\n", missed, timef );
+
+	for ( i=0; i<1+missed/2; i++ )
+	{
+		if ( clock->numdata >= 120 )
+			clkDataClear ( clock );
+
+		clock->data[ clock->numdata++ ] = CLK_DATA_ERASED;
+	}
+
+	clock->msf_skip_b = 0;
+	clock->lockvaltime = 0;
+
+	//time the next pulse from here
+	clock->status = status;
+	clock->changetime = timef;
+}
+
+int
+clkDataErased ( const clkInfoT* clock, int first, int count )
+{
+	int	i, erased;
+
+	erased = 0;
+	for ( i=clock->numdata-60+first; i<clock->numdata-60+first+count; i++ )
+	{
+		if ( i >= 0 && i < clock->numdata && clock->data[i] == CLK_DATA_ERASED )
+			erased++;
+	}
+
+	return erased;
+}
+
+
+//a field has to have been received this many minutes in a row, each agreeing with the ones
+//before, before it is trusted to fill in a minute where it is bad
+#define	CLK_FIELD_CONFIDENT	(2)
+#define	CLK_FIELD_MAXCONFIDENCE	(60)
+//the earlier minutes aren't used after this long
+#define	CLK_FIELD_MAXAGE	(24*60*60)
+
+static int
+clkFieldValue ( time_t local, int field )
+{
+	switch ( field )
+	{
+	case CLK_FIELD_MINUTE:
+		return ( local / 60 ) % 60;
+	case CLK_FIELD_HOUR:
+		return ( local / (60*60) ) % 24;
+	case CLK_FIELD_DAY:
+	default:
+		return local / (24*60*60);
+	}
+}
+
+int
+clkDayNumber ( int year, int mon, int mday )
+{
+	struct tm	date;
+	time_t		datet;
+
+	if ( mon < 0 || mon > 11 || mday < 1 || mday > ( mon == 0 ? 366 : 31 ) )
+		return -1;
+
+	memset ( &date, 0, sizeof(date) );
+	date.tm_year = year;
+	date.tm_mon = mon;
+	date.tm_mday = mday;
+
+	datet = UTCtime ( &date );
+	if ( datet == (time_t)(-1) )
+		return -1;
+
+	return datet / (24*60*60);
+}
+
+time_t
+clkCompleteFields ( clkInfoT* clock, int* fields, const int* valid, int utcoffset, time_f minstart )
+{
+	time_t	predicted, dectimet;
+	int	agree[CLK_FIELDS];
+	int	minutes, agreed, disagreed, filled, i;
+
+	//where the earlier minutes say this one should be (as the station's time)
+	predicted = 0;
+	if ( clock->fieldpctime != 0 && minstart > clock->fieldpctime && minstart - clock->fieldpctime < CLK_FIELD_MAXAGE )
+	{
+		minutes = (int)floor ( ( minstart - clock->fieldpctime ) / 60.0 + 0.5 );
+		predicted = clock->fieldtime + minutes*60 + utcoffset;
+	}
+
+	agreed = 0;
+	disagreed = 0;
+	for ( i=0; i<CLK_FIELDS; i++ )
+	{
+		agree[i] = ( predicted != 0 && valid[i] && fields[i] == clkFieldValue ( predicted, i ) );
+
+		if ( agree[i] )
+			agreed++;
+		else if ( predicted != 0 && valid[i] )
+			disagreed++;
+	}
+
+	//only fill in a single field, when the rest of the minute agrees with the ones before -
+	//with more than one missing, too little of the minute was received to check it
+	filled = 0;
+	for ( i=0; i<CLK_FIELDS; i++ )
+	{
+		if ( valid[i] )
+			continue;
+
+		if ( filled > 0 || predicted == 0 || agreed == 0 || disagreed > 0 || clock->fieldconfidence[i] < CLK_FIELD_CONFIDENT )
+			return -1;
+
+		fields[i] = clkFieldValue ( predicted, i );
+		filled++;
+	}
+
+	dectimet = (time_t)fields[CLK_FIELD_DAY] * 24*60*60 + fields[CLK_FIELD_HOUR] * 60*60
+		+ fields[CLK_FIELD_MINUTE] * 60 - utcoffset;
+
+	for ( i=0; i<CLK_FIELDS; i++ )
+	{
+		if ( agree[i] )
+		{
+			if ( clock->fieldconfidence[i] < CLK_FIELD_MAXCONFIDENCE )
+				clock->fieldconfidence[i]++;
+		}
+		else if ( valid[i] )
+			clock->fieldconfidence[i] = 1;
+	}
+
+	clock->fieldtime = dectimet;
+	clock->fieldpctime = minstart;
+
+	if ( filled > 0 )
+		loggerf ( LOGGER_DEBUG, "clock: a bad field filled in from the earlier minutes\n" );
+
+	return dectimet;
+}
+
+//this many seconds in a row agreeing with the expected minute puts the data back in step
+#define	CLK_LOCK_CONFIRM	(5)
+//a second more than this from where it's expected isn't one of the seconds
+#define	CLK_LOCK_WINDOW		(0.25)
+//the expected minutes aren't used after this long without a second agreeing
+#define	CLK_LOCK_MAXAGE		(60*60)
+
+//fill in lockdata for lockminute - the seconds that aren't known from the time (like the
+//DCF77 weather and the DUT1 bits) are CLK_DATA_ERASED, and aren't checked
+static void
+clkLockEncode ( clkInfoT* clock )
+{
+	int	i;
+
+	switch ( clock->clocktype )
+	{
+	case CLOCKTYPE_MSF:
+		clock->locknum = msfEncode ( clock->lockminute, clock->lockflags, clock->lockdata );
+		for ( i=1; i<=16; i++ )		//DUT1, in the B bits
+			clock->lockdata[i] = CLK_DATA_ERASED;
+		break;
+	case CLOCKTYPE_WWVB:
+		clock->locknum = wwvbEncode ( clock->lockminute, clock->lockflags, clock->lockdata );
+		for ( i=36; i<=43; i++ )	//DUT1 sign and value
+		{
+			if ( clock->lockdata[i] != 8 )
+				clock->lockdata[i] = CLK_DATA_ERASED;
+		}
+		break;
+	case CLOCKTYPE_DCF77:
+	default:
+		clock->locknum = dcf77Encode ( clock->lockminute, clock->lockflags, clock->lockdata );
+		for ( i=0; i<=15; i++ )		//weather and the call bit
+			clock->lockdata[i] = CLK_DATA_ERASED;
+		break;
+	}
+}
+
+void
+clkLockMinute ( clkInfoT* clock, time_t minute, int flags, time_f minstart )
+{
+	clock->lockminute = minute;
+	clock->lockflags = flags & ~CLK_ENCODE_LEAPSECOND;
+	clock->lockpctime = minstart;
+	clkLockEncode ( clock );
+
+	clock->locklost = 0;
+}
+
+//the data has been lost - until enough seconds agree with the expected minute
+static void
+clkLockLost ( clkInfoT* clock )
+{
+	clock->lockvaltime = 0;
+	clock->lockagree = 0;
+
+	if ( clock->locknum > 0 )
+		clock->locklost = 1;
+}
+
+//the last second received (the last value in data[]) has ended - check it against the
+//expected minute, and when the data has been lost, put it back in step if enough agree
+static void
+clkLockCheck ( clkInfoT* clock )
+{
+	time_f	valtime, offset;
+	int	sec, minutes, kept, i;
+
+	valtime = clock->lockvaltime;
+	clock->lockvaltime = 0;
+
+	if ( valtime == 0 || clock->locknum == 0 )
+		return;
+
+	offset = valtime - clock->lockpctime;
+
+	if ( offset < 0 || offset > clock->locknum + CLK_LOCK_MAXAGE )
+	{
+		loggerf ( LOGGER_DEBUG, "clock: too long since the last minute to check the seconds against it\n" );
+		clock->locknum = 0;
+		clock->locklost = 0;
+		return;
+	}
+
+	//on to the minute the second is in
+	sec = (int)floor ( offset + 0.5 );
+	if ( sec >= clock->locknum )
+	{
+		minutes = ( sec - clock->locknum ) / 60;
+		clock->lockpctime += clock->locknum + minutes*60;
+		clock->lockminute += ( minutes+1 ) * 60;
+		clkLockEncode ( clock );
+
+		offset = valtime - clock->lockpctime;
+		sec = (int)floor ( offset + 0.5 );
+	}
+
+	if ( fabs ( offset - sec ) > CLK_LOCK_WINDOW || clock->lockdata[sec] == CLK_DATA_ERASED )
+		return;
+
+	clock->lockseconds++;
+	if ( clock->lockval != clock->lockdata[sec] )
+	{
+		clock->lockerrors++;
+		clock->lockagree = 0;
+		return;
+	}
+
+	//follow the seconds, so the pc clock can drift while the data is lost
+	clock->lockpctime += offset - sec;
+	clock->lockagree++;
+
+	if ( !clock->locklost || clock->lockagree < CLK_LOCK_CONFIRM )
+		return;
+
+	loggerf ( LOGGER_DEBUG, "clock: back in step at second %d, after %d seconds agreeing with the expected minute\n", sec, clock->lockagree );
+
+	//the minute so far is the data received since it was lost, with the seconds before erased -
+	//the rest of it can be decoded as usual
+	kept = clock->numdata < sec+1 ? clock->numdata : sec+1;
+	memmove ( clock->data + sec+1-kept, clock->data + clock->numdata-kept, kept );
+	for ( i=0; i<sec+1-kept; i++ )
+		clock->data[i] = CLK_DATA_ERASED;
+	clock->numdata = sec+1;
+	clock->minutesync = 1;
+	clock->msf_skip_b = 0;
+
+	//and the time is known again from this second
+	clock->pctime = clock->lockpctime + sec;
+	clock->radiotime = clock->lockminute + sec + clock->fudgeoffset;
+	clock->secondssincetime = 0;
+	clkSendTime ( clock );
+
+	clock->locklost = 0;
+}
+
+//to ntpd's shared memory, and chronyd's socket
+static void
+clkStore ( clkInfoT* clock, time_f radiotime, time_f pctime, time_f maxerr )
+{
+	if ( debugLevel )
+		return;
+
+	if ( clock->shm != NULL )
+		shmStore ( clock->shm, radiotime, pctime, maxerr, clock->radioleap );
+	if ( clock->sock != NULL )
+		sockStore ( clock->sock, radiotime, pctime, clock->radioleap, 0 );
+}
+
+//how far (in standard deviations) a clock can be from the median of them all, and still be
+//combined - but never less than this far (the delay fudges are only known so well)
+#define	CLK_FUSE_OUTLIERS	(4.0)
+#define	CLK_FUSE_MINDIFF	(0.0005)
+#define	CLK_FUSE_MAX		(32)
+
+//the first clock to send each minute sends every clock's offset from its filter at the same pc
+//time, weighted by its error, as one - leaving out any that decoded a different time, or
+//whose offset is too far from the others (with two that disagree, neither can be trusted)
+static void
+clkFuse ( clkInfoT* clock )
+{
+	clkInfoT*	c;
+	clkInfoT*	clocks[CLK_FUSE_MAX];
+	time_f		offsets[CLK_FUSE_MAX], errors[CLK_FUSE_MAX], sorted[CLK_FUSE_MAX];
+	time_f		now, median, diff, w, total, sum, chi, offset, err;
+	time_t		minute;
+	int		n, used, i, j;
+
+	now = clock->radiotime - clock->fudgeoffset;
+	minute = (time_t)floor ( now / 60 + 0.5/60 ) * 60;
+	if ( minute == clkFuseMinute )
+		return;
+
+	n = 0;
+	for ( c = clkListHead; c != NULL && n < CLK_FUSE_MAX; c = c->next )
+	{
+		if ( c->radiotime == 0 || clkPredictPPS ( c, clock->pctime, &offsets[n], &errors[n] ) < 0 )
+			continue;
+
+		//the time it decoded, as of this clock's - seconds out means a different time
+		diff = c->radiotime - c->fudgeoffset + ( clock->pctime - c->pctime ) - now;
+		if ( fabs ( diff ) > 0.5 )
+		{
+			loggerf ( LOGGER_DEBUG, "clock: fused time leaves out a clock %.0f seconds out\n", diff );
+			c->fuserejects++;
+			continue;
+		}
+
+		clocks[n] = c;
+		n++;
+	}
+	if ( n == 0 )
+		return;
+
+	//(insertion sort - there are only a few)
+	for ( i=0; i<n; i++ )
+	{
+		for ( j=i; j>0 && sorted[j-1] > offsets[i]; j-- )
+			sorted[j] = sorted[j-1];
+		sorted[j] = offsets[i];
+	}
+	median = ( sorted[(n-1)/2] + sorted[n/2] ) / 2;
+
+	total = 0;
+	sum = 0;
+	used = 0;
+	for ( i=0; i<n; i++ )
+	{
+		diff = offsets[i] - median;
+		if ( fabs ( diff ) > CLK_FUSE_OUTLIERS * sqrt ( errors[i]*errors[i] + CLK_FUSE_MINDIFF*CLK_FUSE_MINDIFF ) )
+		{
+			loggerf ( LOGGER_DEBUG, "clock: fused time leaves out a clock "TIMEF_FORMAT" from the others\n", diff );
+			clocks[i]->fuserejects++;
+			errors[i] = 0;
+			continue;
+		}
+
+		w = 1 / ( errors[i]*errors[i] );
+		total += w;
+		sum += w * offsets[i];
+		used++;
+	}
+	if ( used == 0 )
+		return;
+
+	offset = sum / total;
+	err = 1 / sqrt ( total );
+
+	//if they're further apart than their errors say, the error is that much bigger
+	chi = 0;
+	for ( i=0; i<n; i++ )
+	{
+		if ( errors[i] == 0 )
+			continue;
+		chi += ( offsets[i] - offset ) * ( offsets[i] - offset ) / ( errors[i]*errors[i] );
+		clocks[i]->fuseused++;
+	}
+	if ( used > 1 && chi > used-1 )
+		err *= sqrt ( chi / (used-1) );
+
+	clkFuseMinute = minute;
+
+	loggerf ( LOGGER_DEBUG, "clock: fused %d of %d clocks, radio time "TIMEF_FORMAT", pctime "TIMEF_FORMAT", error +-"TIMEF_FORMAT"\n",
+		used, n, clock->radiotime, clock->radiotime + offset, err );
+
+	if ( !debugLevel && clkFuseShm != NULL )
+		shmStore ( clkFuseShm, clock->radiotime, clock->radiotime + offset, err, clock->radioleap );
+}
+
+#ifdef ENABLE_DISCIPLINE
+//-A: the first clock to settle steers the kernel clock - and everything the clocks have
+//measured against the pc clock is moved by as much as it was
+static clkInfoT* clkDisciplineClock;
+
+static void
+clkDiscipline ( clkInfoT* clock, time_f offset, time_f err )
+{
+	clkInfoT*	c;
+	time_f		step, freq;
+	int		stepped, i;
+
+	if ( clkDisciplineClock == NULL )
+		clkDisciplineClock = clock;
+	if ( clock != clkDisciplineClock )
+		return;
+
+	stepped = discUpdate ( offset, err, clock->filterfreq, clock->radioleap, &step, &freq );
+	if ( stepped < 0 )
+		return;
+
+	for ( c = clkListHead; c != NULL; c = c->next )
+	{
+		c->filterfreq += freq;
+		c->filteroffset += step;
+		for ( i=0; i<c->ppswindow; i++ )
+		{
+			c->ppsoffsets[i] += step;
+			c->ppssorted[i] += step;
+		}
+
+		//the pc times things started at
+		c->pctime += step;
+		if ( c->filtertime != 0 )
+			c->filtertime += step;
+		if ( c->fieldpctime != 0 )
+			c->fieldpctime += step;
+		c->lockpctime += step;
+		if ( c->lockvaltime != 0 )
+			c->lockvaltime += step;
+		for ( i=0; i<CLK_DIVERSITY_SECONDS; i++ )
+		{
+			if ( c->divtime[i] != 0 )
+				c->divtime[i] += step;
+		}
+		if ( c->firstedge != 0 )
+			c->firstedge += step;
+		if ( c->firstdecode != 0 )
+			c->firstdecode += step;
+		if ( c->lastdecode != 0 )
+			c->lastdecode += step;
+		//(a slew moves the clock gradually - the pulse under way is only out by a step)
+		if ( stepped && c->changetime != 0 )
+			c->changetime += step;
+	}
+}
+#endif
+
 void
 clkSendTime ( clkInfoT* clock )
 {
 	time_f	average, maxerr;
 
-	if ( clkCalculatePPSAverage ( clock, &average, &maxerr ) < 0 )
+	if ( clkPredictPPS ( clock, clock->pctime, &average, &maxerr ) >= 0 )
+	{
+		loggerf ( LOGGER_DEBUG, "clock: radio time "TIMEF_FORMAT", filtered pctime "TIMEF_FORMAT", error +-"TIMEF_FORMAT", frequency %+.3fppm\n",
+			clock->radiotime, clock->radiotime + average, maxerr, clock->filterfreq * 1e6 );
+
+		clkStore ( clock, clock->radiotime, clock->radiotime + average, maxerr );
+		if ( shmFuseUnit >= 0 )
+			clkFuse ( clock );
+#ifdef ENABLE_DISCIPLINE
+		if ( clockDiscipline )
+			clkDiscipline ( clock, average, maxerr );
+#endif
+	}
+	else if ( clkCalculatePPSAverage ( clock, &average, &maxerr ) < 0 )
 	{
 		maxerr = 0.005;
 
 		loggerf ( LOGGER_DEBUG, "clock: radio time "TIMEF_FORMAT", pc time "TIMEF_FORMAT"\n", clock->radiotime, clock->pctime );
 
-		if ( !debugLevel )
-			shmStore ( clock->shm, clock->radiotime, clock->pctime, maxerr, clock->radioleap );
+		clkStore ( clock, clock->radiotime, clock->pctime, maxerr );
 	}
 	else
 	{
 		loggerf ( LOGGER_DEBUG, "clock: radio time "TIMEF_FORMAT", average pctime "TIMEF_FORMAT", error +-"TIMEF_FORMAT"\n", clock->radiotime, clock->radiotime + average, maxerr );
 
-		if ( !debugLevel )
-			shmStore ( clock->shm, clock->radiotime, clock->radiotime + average, maxerr, clock->radioleap );
+		clkStore ( clock, clock->radiotime, clock->radiotime + average, maxerr );
 	}
 
 }
 
+void
+clkSendSecond ( clkInfoT* clock, time_f timef )
+{
+	time_f	radiotime;
+
+	radiotime = clock->radiotime + clock->secondssincetime;
+
+	loggerf ( LOGGER_TRACE, "clock: second "TIMEF_FORMAT", pc time "TIMEF_FORMAT", error +-"TIMEF_FORMAT"\n", radiotime, timef, clock->filternoise );
+
+	if ( shmEverySecond )
+		clkStore ( clock, radiotime, timef, clock->filternoise );
+
+	//a PPS has the whole second, and the edge - so the fudge is taken off that instead
+	if ( !debugLevel && clock->ppsshm != NULL )
+		shmStore ( clock->ppsshm, floor ( radiotime - clock->fudgeoffset + 0.5 ), timef - clock->fudgeoffset, clock->filternoise, clock->radioleap );
+}
+
 void
 clkProcessPPS ( clkInfoT* clock, time_f timef )
 {
-//	time_f	average, maxerr;
+	time_f	offset;
 
 	//cant process second pulses unless we have decoded the time...
 	if ( clock->radiotime == 0 )
 		return;
 
-	clock->secondssincetime += 1.0;
+	//which second this is, from the pc time since the radio time (at the pc clock's rate) -
+	//rather than counting them, as seconds lost with the data would put the count out
+	clock->secondssincetime = (int)floor ( ( timef - clock->pctime ) / ( 1 + clock->filterfreq ) + 0.5 );
 
-	clock->ppslist[clock->ppsindex].pctime = timef;
-	clock->ppslist[clock->ppsindex].radiotime = clock->radiotime + clock->secondssincetime;
-	clock->ppsindex++;
-	clock->ppsindex %= PPS_AVERAGE_COUNT;
+	offset = timef - ( clock->radiotime + clock->secondssincetime );
+	clkAddPPSOffset ( clock, offset );
+	if ( clkFilterPPS ( clock, timef, offset ) >= 0 )
+		clkSendSecond ( clock, timef );
+}
+
+
+//the first of the n sorted values that isn't less than val
+static int
+clkPPSLowerBound ( const time_f* sorted, int n, time_f val )
+{
+	int	lo, hi, mid;
 
-//	if ( clkCalculatePPSAverage ( clock, &average, &maxerr ) >= 0 )
-//	{
-//
-//	}
+	lo = 0;
+	hi = n;
+	while ( lo < hi )
+	{
+		mid = ( lo + hi ) / 2;
+		if ( sorted[mid] < val )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
 }
 
+//the oldest offset makes way for the new one - each is found in the sorted copy by a binary
+//search, so the window never needs sorting (the memmove is at most the window, which is
+//cheaper than a tree at the sizes used)
+void
+clkAddPPSOffset ( clkInfoT* clock, time_f offset )
+{
+	int	at;
 
+	if ( clock->ppsnum == clock->ppswindow )
+	{
+		at = clkPPSLowerBound ( clock->ppssorted, clock->ppsnum, clock->ppsoffsets[clock->ppsindex] );
+		memmove ( clock->ppssorted + at, clock->ppssorted + at+1, ( clock->ppsnum - at-1 ) * sizeof(time_f) );
+		clock->ppsnum--;
+	}
+
+	clock->ppsoffsets[clock->ppsindex] = offset;
+	clock->ppsindex++;
+	clock->ppsindex %= clock->ppswindow;
 
+	at = clkPPSLowerBound ( clock->ppssorted, clock->ppsnum, offset );
+	memmove ( clock->ppssorted + at+1, clock->ppssorted + at, ( clock->ppsnum - at ) * sizeof(time_f) );
+	clock->ppssorted[at] = offset;
+	clock->ppsnum++;
+}
 
-static int
-sort_timef_compare ( const void* a, const void* b )
+
+//offsets further than this many (robust) standard deviations from the median are left out -
+//but never closer than CLK_PPS_MINLIMIT
+#define	CLK_PPS_OUTLIERS	(5.0)
+#define	CLK_PPS_MINLIMIT	(0.002)
+//the standard deviation of normally distributed values, from their median absolute deviation
+#define	CLK_PPS_MADSIGMA	(1.4826)
+
+//the median of the distances of the sorted values from their median - walking out from it
+static time_f
+clkPPSMedianDeviation ( const time_f* sorted, int n, time_f median )
 {
-	time_f	ta,tb;
+	time_f	dev;
+	int	lo, hi, k;
 
-	ta = *(time_f*)a;
-	tb = *(time_f*)b;
+	hi = clkPPSLowerBound ( sorted, n, median );
+	lo = hi - 1;
+	dev = 0;
 
-	if ( ta < tb )
-		return -1;
-	else if ( ta > tb )
-		return +1;
-	return 0;
+	for ( k=0; k<=(n-1)/2; k++ )
+	{
+		if ( hi >= n || ( lo >= 0 && median - sorted[lo] < sorted[hi] - median ) )
+			dev = median - sorted[lo--];
+		else
+			dev = sorted[hi++] - median;
+	}
+
+	return dev;
 }
 
 int
 clkCalculatePPSAverage ( clkInfoT* clock, time_f* paverage, time_f* pmaxerr )
 {
-	int	i;
-	time_f	err;
-	time_f	total_offset,average_offset;
-	int	total_count;
-	time_f	standard_deviation;
-	time_f	timediff[PPS_AVERAGE_COUNT] = { 0.0 };
+	const time_f*	sorted;
+	time_f	median, sigma, limit, total;
+	int	n, lo, hi, i;
 
+	//a whole window of seconds is needed...
+	n = clock->ppsnum;
+	if ( n < clock->ppswindow || n == 0 )
+		return -1;
 
-	for ( i=0; i<PPS_AVERAGE_COUNT; i++ )
-	{
-		if ( clock->ppslist[i].pctime == 0 || clock->ppslist[i].radiotime == 0 )
-			return -1;
+	sorted = clock->ppssorted;
+	median = ( sorted[(n-1)/2] + sorted[n/2] ) / 2;
 
-		err = clock->ppslist[i].pctime - clock->ppslist[i].radiotime;
-		//if the time isn't close, don't bother tracking it...
-		if ( fabs ( err ) > 0.1 )	//within 100ms - more than this and ntpd will step the time soon
-			return -1;
+	//if the time isn't close, don't bother tracking it...
+	if ( fabs ( median ) > 0.1 )	//within 100ms - more than this and ntpd will step the time soon
+		return -1;
 
-		timediff[i] = err;
-	}
+	sigma = CLK_PPS_MADSIGMA * clkPPSMedianDeviation ( sorted, n, median );
 
-	qsort ( timediff, PPS_AVERAGE_COUNT, sizeof(time_f), sort_timef_compare );
+	//...but a few seconds that are way out are just left out
+	limit = CLK_PPS_OUTLIERS * sigma;
+	if ( limit < CLK_PPS_MINLIMIT )
+		limit = CLK_PPS_MINLIMIT;
 
+	lo = clkPPSLowerBound ( sorted, n, median - limit );
+	hi = clkPPSLowerBound ( sorted, n, median + limit );
+	while ( hi < n && sorted[hi] == median + limit )
+		hi++;
 
-	total_offset = 0;
-	total_count = 0;
-	for ( i=PPS_AVERAGE_COUNT/4; i<PPS_AVERAGE_COUNT*3/4; i++ )
-	{
-		err = timediff[i];
+	if ( ( hi - lo ) * 2 < n )
+		return -1;
 
-		total_offset += err;
-		total_count++;
+	//the mean of the middle half of the rest
+	total = 0;
+	for ( i=lo+(hi-lo)/4; i<hi-(hi-lo)/4; i++ )
+		total += sorted[i];
 
-	}
+	*paverage = total / ( hi-lo - 2*((hi-lo)/4) );
+	*pmaxerr = sigma;
+
+	return 0;
+}
+
+
+//the filter's noise, as variances per second - the offset and the frequency both wander
+//(the pc oscillator warms and cools, and ntpd steers it)
+#define	CLK_FILTER_PHASENOISE	(1e-12)
+#define	CLK_FILTER_FREQNOISE	(1e-13)
+//to start with, the frequency is only known to +-50ppm...
+#define	CLK_FILTER_STARTFREQ	(50e-6)
+//...and each second to +-5ms, until there's a window of them to tell (never better than this)
+#define	CLK_FILTER_STARTNOISE	(0.005)
+#define	CLK_FILTER_MINNOISE	(0.0002)
+//seconds further out than this many standard deviations are left out - unless there are so
+//many in a row that the offset must have moved (the pc clock was stepped)
+#define	CLK_FILTER_OUTLIERS	(5.0)
+#define	CLK_FILTER_MAXREJECTS	(10)
+
+static void
+clkFilterStart ( clkInfoT* clock, time_f timef, time_f offset, time_f noise )
+{
+	clock->filtertime = timef;
+	clock->filteroffset = offset;
+	clock->filterfreq = 0;
+	clock->filtercov[0][0] = noise;
+	clock->filtercov[0][1] = 0;
+	clock->filtercov[1][0] = 0;
+	clock->filtercov[1][1] = CLK_FILTER_STARTFREQ * CLK_FILTER_STARTFREQ;
+	clock->filtercount = 1;
+	clock->filterrejects = 0;
+}
+
+//the covariance dt after the last second (the offset moves by freq*dt)
+static void
+clkFilterCovariance ( const clkInfoT* clock, time_f dt, time_f* p00, time_f* p01, time_f* p11 )
+{
+	*p00 = clock->filtercov[0][0] + 2*dt*clock->filtercov[0][1] + dt*dt*clock->filtercov[1][1]
+		+ CLK_FILTER_PHASENOISE*dt + CLK_FILTER_FREQNOISE*dt*dt*dt/3;
+	*p01 = clock->filtercov[0][1] + dt*clock->filtercov[1][1] + CLK_FILTER_FREQNOISE*dt*dt/2;
+	*p11 = clock->filtercov[1][1] + CLK_FILTER_FREQNOISE*dt;
+}
 
-	average_offset = total_offset / total_count;
+int
+clkFilterPPS ( clkInfoT* clock, time_f timef, time_f offset )
+{
+	time_f	noise, median, dt, predicted, innov, s, k0, k1;
+	time_f	p00, p01, p11;
+	int	n;
+
+	//how far out each second is - from the spread of the window
+	noise = CLK_FILTER_STARTNOISE;
+	n = clock->ppsnum;
+	if ( n == clock->ppswindow )
+	{
+		median = ( clock->ppssorted[(n-1)/2] + clock->ppssorted[n/2] ) / 2;
+		noise = CLK_PPS_MADSIGMA * clkPPSMedianDeviation ( clock->ppssorted, n, median );
+		if ( noise < CLK_FILTER_MINNOISE )
+			noise = CLK_FILTER_MINNOISE;
+	}
+	clock->filternoise = noise;
+	noise *= noise;
 
-	standard_deviation = 0;
-	for ( i=0; i<PPS_AVERAGE_COUNT; i++ )
+	if ( clock->filtertime == 0 || timef <= clock->filtertime )
 	{
-		if ( clock->ppslist[i].pctime == 0 || clock->ppslist[i].radiotime == 0 )
-			continue;
+		clkFilterStart ( clock, timef, offset, noise );
+		return -1;
+	}
 
-		err = (clock->ppslist[i].pctime - clock->ppslist[i].radiotime) - average_offset;
+	dt = timef - clock->filtertime;
+	predicted = clock->filteroffset + clock->filterfreq * dt;
+	clkFilterCovariance ( clock, dt, &p00, &p01, &p11 );
 
-		standard_deviation += err*err;
+	innov = offset - predicted;
+	s = p00 + noise;
+	if ( innov*innov > CLK_FILTER_OUTLIERS*CLK_FILTER_OUTLIERS * s )
+	{
+		if ( ++clock->filterrejects >= CLK_FILTER_MAXREJECTS )
+		{
+			loggerf ( LOGGER_DEBUG, "clock: the offset has moved by "TIMEF_FORMAT" - restarting its filter\n", innov );
+			clkFilterStart ( clock, timef, offset, noise );
+		}
+		return -1;
 	}
-	standard_deviation /= total_count;
-	standard_deviation = sqrt ( standard_deviation );
+	clock->filterrejects = 0;
 
-	*paverage = average_offset;
-	*pmaxerr = standard_deviation;	//over50%   * 2.0;	//over 90% of the values should be in this range...
+	k0 = p00 / s;
+	k1 = p01 / s;
+
+	clock->filteroffset = predicted + k0 * innov;
+	clock->filterfreq += k1 * innov;
+	clock->filtercov[0][0] = ( 1 - k0 ) * p00;
+	clock->filtercov[0][1] = ( 1 - k0 ) * p01;
+	clock->filtercov[1][0] = clock->filtercov[0][1];
+	clock->filtercov[1][1] = p11 - k1 * p01;
+
+	clock->filtertime = timef;
+	clock->filtercount++;
 
 	return 0;
 }
 
+int
+clkPredictPPS ( const clkInfoT* clock, time_f timef, time_f* poffset, time_f* perror )
+{
+	time_f	dt, p00, p01, p11;
+
+	//(it has to have settled - as long as the window takes to fill)
+	if ( clock->filtertime == 0 || clock->filtercount < clock->ppswindow )
+		return -1;
+
+	dt = timef - clock->filtertime;
+	clkFilterCovariance ( clock, dt, &p00, &p01, &p11 );
+
+	*poffset = clock->filteroffset + clock->filterfreq * dt;
+	*perror = sqrt ( p00 );
+
+	return 0;
+}
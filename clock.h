@@ -4,14 +4,47 @@
 #include "systime.h"
 #include "timef.h"
 #include "shm.h"
+#include "sock.h"
 
 
-#define	PPS_AVERAGE_COUNT		(60)
-
 #define CLOCKTYPE_DCF77	0
 #define CLOCKTYPE_MSF	1
 #define CLOCKTYPE_WWVB	2
 
+//the fields of a minute that are checked on their own - in the station's own time, as
+//minute of the hour, hour of the day, and days since 1970 (see clkCompleteFields())
+#define	CLK_FIELD_MINUTE	(0)
+#define	CLK_FIELD_HOUR		(1)
+#define	CLK_FIELD_DAY		(2)
+#define	CLK_FIELDS		(3)
+
+
+//xxxEncode() in the decode_*.c files is the reverse of xxxDecode() - it fills in the
+//data[] values for each second of a minute (0 for no pulse). flags are some of:
+#define	CLK_ENCODE_DST		(1)	//summer time, for the time sent
+#define	CLK_ENCODE_DSTSOON	(2)	//summer time starts or ends soon
+#define	CLK_ENCODE_LEAPSOON	(4)	//a leap second is due soon
+#define	CLK_ENCODE_LEAPSECOND	(8)	//this minute ends with a leap second (61 seconds)
+#define	CLK_ENCODE_MAX		(61)	//the size of data[]
+
+
+//pulse and clear lengths are classified by a table, of the length (in 10ths) for each
+//CLK_PULSE_STEP up to 2s, or -1. each clock learns its own, from the lengths it receives -
+//receivers stretch or shorten the pulses (see clkPulseLearn())
+#define	CLK_PULSE_STEP		(0.002)
+#define	CLK_PULSE_SLOTS		(1001)
+#define	CLK_PULSE_CLASSES	(7)	//the most lengths a station has
+
+typedef struct
+{
+	signed char	table[CLK_PULSE_SLOTS];
+	int		classes;
+	time_f		nominal[CLK_PULSE_CLASSES];	//the station's lengths...
+	time_f		mean[CLK_PULSE_CLASSES];	//...the lengths as received...
+	time_f		dev[CLK_PULSE_CLASSES];		//...and their mean deviation
+	int		learned;	//lengths learned since the table was built
+} clkPulseClassT;
+
 
 typedef struct clkInfoS clkInfoT;
 struct clkInfoS
@@ -24,12 +57,32 @@ struct clkInfoS
 	int	status;
 	time_f	changetime;
 
+	clkPulseClassT	pulses;	//the lengths learned for pulses, and for the gaps between them
+	clkPulseClassT	clears;
+
 
 	//store 2 minutes of data - there will be a complete minute of data in here somewhere...
+	//(a second lost to missed edges is stored as CLK_DATA_ERASED)
+#define	CLK_DATA_ERASED	(-1)
+	//(up to this many seconds in a row with no pulse at all are erased too)
+#define	CLK_MAX_MISSING	(5)
 	signed char	data[120];
 	int		numdata;
 
 	int		msf_skip_b;	//set to 1 if we have a 100ms high after a 100ms low
+	int		minutesync;	//data[0] is the first second of a minute (cleared by clkDataClear())
+
+	//-G: clocks in the same group hear the same station - each second of a minute is
+	//decoded from whichever of them received it best (see clkDiversity()), so they keep
+	//the last seconds received, by the pc time they started, with how far each length was
+	//from the one learned (in deviations)
+#define	CLK_DIVERSITY_SECONDS	(128)
+	int		group;		//0 for none
+	time_f		divtime[CLK_DIVERSITY_SECONDS];
+	signed char	divval[CLK_DIVERSITY_SECONDS];	//(or CLK_DATA_ERASED)
+	time_f		divquality[CLK_DIVERSITY_SECONDS];
+	int		divindex;
+	unsigned long	divfilled;	//seconds taken from the others in the group
 
 	time_f		pctime;
 	time_f		radiotime;
@@ -38,20 +91,73 @@ struct clkInfoS
 
 	int	secondssincetime;
 
-	struct
-	{
-		time_f	pctime;
-		time_f	radiotime;
-	} ppslist[PPS_AVERAGE_COUNT];
+	//the offsets (pc time less radio time) of the second pulses, for the last ppswindow
+	//seconds - in the order they arrived, and sorted (see clkAddPPSOffset())
+	time_f*	ppsoffsets;
+	time_f*	ppssorted;
+	int	ppswindow;
+	int	ppsnum;
 	int	ppsindex;
 
+	//a Kalman filter of the offset and how fast it changes (the pc clock's frequency error),
+	//from the same seconds - for the offset at the time sent (see clkFilterPPS())
+	time_f	filtertime;	//the pc time of the last second in it (0 until started)
+	time_f	filteroffset;
+	time_f	filterfreq;
+	time_f	filtercov[2][2];	//the covariance of offset and freq
+	int	filtercount;	//seconds since it started
+	int	filterrejects;	//seconds in a row too far out to be used
+	time_f	filternoise;	//the standard deviation of a second
+
+
+	//the last minute decoded (UTC), the pc time it started, and how many minutes in a row
+	//each field has been received agreeing with the minutes before
+	time_t		fieldtime;
+	time_f		fieldpctime;
+	int		fieldconfidence[CLK_FIELDS];
+
+	//what each second of the minute after the last one decoded should be, to check the
+	//seconds against as they arrive - and to get back in step a few seconds after losing
+	//the data, rather than waiting for the next minute marker (see clkLockMinute())
+	signed char	lockdata[CLK_ENCODE_MAX];
+	int		locknum;	//seconds in lockdata (0 until a minute has been decoded)
+	time_t		lockminute;	//the UTC time of the minute in lockdata...
+	int		lockflags;	//...its xxxEncode() flags...
+	time_f		lockpctime;	//...and the pc time it started
+	int		lockval;	//the last second received, not checked yet...
+	time_f		lockvaltime;	//...and the pc time it started (0 if none)
+	int		lockagree;	//seconds in a row agreeing with lockdata
+	int		locklost;	//set when the data is lost, until enough seconds agree again
+	unsigned long	lockseconds;	//seconds checked, and how many of them disagreed -
+	unsigned long	lockerrors;	//  a measure of the signal quality
+
 	shmTimeT*	shm;
+	shmTimeT*	ppsshm;	//each second is sent here too, as a PPS (or NULL)
+	sockSinkT*	sock;	//everything sent to shm goes to chronyd's socket too (or NULL)
+
+	unsigned long	fuseused;	//minutes this clock was combined into the -F unit, and
+	unsigned long	fuserejects;	//  left out of it for disagreeing with the others
+
+	//the receiver's health, for -m (see metrics.h)
+	unsigned long	edges;		//changes on the line...
+	unsigned long	missededges;	//...and edges missed between them
+	unsigned long	badshort;	//pulses too short for any length (noise in a gap?), and too
+	unsigned long	badlong;	//  long (missing gaps)
+	unsigned long	decodesfull;	//minutes decoded from a whole minute of seconds...
+	unsigned long	decodespartial;	//...and with some erased, or the minute short
+	unsigned long	failshort;	//minutes that failed to decode with seconds erased or missing...
+	unsigned long	failinvalid;	//...and with all of them, but bad data
+	time_f		firstedge;	//the pc time of the first edge,
+	time_f		firstdecode;	//  the first minute decoded,
+	time_f		lastdecode;	//  and the last (0 for none)
 };
 
 
 void clkDumpData ( const clkInfoT* clock );
 
-clkInfoT* clkCreate ( int inverted, int shmunit, time_f fudgeoffset, int clocktype );
+//shmkey is the key for the shared memory unit (-1 for SHM_KEY + shmunit), and shmperm its
+//permissions (the pps and combined units are at the same offset from it) - sockpath is a chronyd SOCK refclock to send to as well (or NULL)
+clkInfoT* clkCreate ( int inverted, int shmunit, int shmkey, int shmperm, const char* sockpath, time_f fudgeoffset, int clocktype );
 
 void clkDataClear ( clkInfoT* clock );
 
@@ -59,10 +165,34 @@ int clkPulseLength ( time_f timef, int clocktype );
 
 
 void clkProcessStatusChange ( clkInfoT* clock, int Status, time_f timef );
+//missed edges have been detected before the line went to status at timef
+void clkProcessErasure ( clkInfoT* clock, int status, int missed, time_f timef );
+//returns the number of erased seconds in count seconds from first, of the last 60 seconds of data
+int clkDataErased ( const clkInfoT* clock, int first, int count );
+
+//fields[] is a minute as received, and valid[] which fields were clean (by parity, range,
+//and no erasures). fields that weren't are filled in from the earlier minutes, if they
+//can be trusted. returns the UTC time of the minute (utcoffset is the station's time less
+//UTC), or -1 if it can't be completed
+time_t clkCompleteFields ( clkInfoT* clock, int* fields, const int* valid, int utcoffset, time_f minstart );
+//days since 1970 for a date (tm_year, tm_mon and tm_mday - with mon 0, mday can be the day of
+//the year), for CLK_FIELD_DAY. -1 if it isn't a date
+int clkDayNumber ( int year, int mon, int mday );
+
+//a minute has been decoded as starting at minute (UTC) and minstart (pc time) - the seconds
+//after it are checked against xxxEncode ( minute, flags )
+void clkLockMinute ( clkInfoT* clock, time_t minute, int flags, time_f minstart );
 
 void clkSendTime ( clkInfoT* clock );
+//a second that the filter has used, with the pc time of its edge
+void clkSendSecond ( clkInfoT* clock, time_f timef );
 
 void clkProcessPPS ( clkInfoT* clock, time_f timef );
+void clkAddPPSOffset ( clkInfoT* clock, time_f offset );
+//returns -1 if the second wasn't used (it starts the filter, or is too far out)
+int clkFilterPPS ( clkInfoT* clock, time_f timef, time_f offset );
+//the offset the filter predicts at timef, and its standard deviation
+int clkPredictPPS ( const clkInfoT* clock, time_f timef, time_f* poffset, time_f* perror );
 
 //void clkDumpPPS ( clkInfoT* clock );
 
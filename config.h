@@ -5,18 +5,44 @@
 
 
 
-#if HAVE_DECL_TIOCMIWAIT && HAVE_ALARM
+#if HAVE_DECL_TIOCMIWAIT && HAVE_PTHREAD_H
 // ioctl(serialfd,TIOCMIWAIT,..) waits for a serial interrupt
-// alarm() is used as a timeout on the above
+// it blocks, so each device waits in its own thread
 # define ENABLE_TIOCMIWAIT
 #endif
 
+#if defined(ENABLE_TIOCMIWAIT) && HAVE_DECL_TIOCGICOUNT && HAVE_LINUX_SERIAL_H
+// the interrupt counts (TIOCGICOUNT) show edges that toggled between two waits
+# define ENABLE_TIOCGICOUNT
+#endif
+
 
-#if HAVE_SYS_TIMEPPS_H
+#if HAVE_SYS_TIMEPPS_H || HAVE_LINUX_PPS_H
 // if <sys/timepps.h> is available, enable pps code
+// (or <linux/pps.h> - timepps.h provides the api on top of it)
 #define ENABLE_TIMEPPS
 #endif
 
+#if defined(ENABLE_TIMEPPS) && defined(__linux__) && HAVE_PTHREAD_H
+// LinuxPPS can block in time_pps_fetch() with a timeout - FreeBSD can't
+# define ENABLE_TIMEPPS_WAIT
+#endif
+
+#if defined(ENABLE_TIMEPPS) && defined(__linux__)
+// attach the pps line discipline to serial ports used for timepps
+# define ENABLE_PPS_LDISC
+#endif
+
+#if defined(ENABLE_TIOCMIWAIT) || defined(ENABLE_TIMEPPS_WAIT)
+// some modes block waiting for a change, in a thread for each device
+# define ENABLE_WAITTHREAD
+#endif
+
+#if HAVE_PTHREAD_H
+// decode in a separate thread from the event loop, passing the edges through a ring
+# define ENABLE_DECODETHREAD
+#endif
+
 
 #if HAVE_MLOCKALL && HAVE_SYS_MMAN_H
 // 
@@ -27,8 +53,28 @@
 # define ENABLE_SCHED
 #endif
 
+#if HAVE_SYS_EPOLL_H && HAVE_SYS_TIMERFD_H
+// epoll() and timerfd for the event loop, otherwise poll() is used
+# define ENABLE_EPOLL
+#endif
+
 #ifdef __arm__
 #define ENABLE_GPIO
 #endif
 
+#if HAVE_PTHREAD_H
+// radioclkd2 -m serves each clock's counters on a unix socket, from a thread of its own
+# define ENABLE_METRICS
+#endif
+
+#if HAVE_SYS_TIMEX_H && HAVE_ADJTIMEX
+// radioclkd2 -A can discipline the kernel clock itself, without ntpd
+# define ENABLE_DISCIPLINE
+#endif
+
+#if HAVE_DECL_GPIO_V2_GET_LINE_IOCTL
+// linux gpio character device (/dev/gpiochipN), v2 uAPI - kernel 5.10 or later
+# define ENABLE_GPIOCHIP
+#endif
+
 #endif
@@ -105,56 +105,52 @@ int
 dcf77Decode ( clkInfoT* clock, time_f minstart )
 {
 	struct tm	dectime;
-	time_t		dectimet;
+	time_t		dectimet, local;
+	int		fields[CLK_FIELDS];
+	int		valid[CLK_FIELDS];
+	int		utcoffset, wday;
 
 	dcf77Dump ( clock );
 
 	if ( !DATA_OK(15) )
 		return -1;
 
-
-	if ( !GET(20) )	//start bit
-		return -1;
-
-
-	if ( dcf77CheckParity ( clock, 21, 7, 28 ) )	//minutes parity
+	//the flags for the whole minute have to be there...
+	if ( clkDataErased ( clock, 17, 4 ) )	//edges were missed in Z1/Z2 or the start bit
 		return -1;
 
-	if ( dcf77CheckParity ( clock, 29, 6, 35 ) )	//hours parity
-		return -1;
-
-	if ( dcf77CheckParity ( clock, 36, 22, 58 ) )	//day/dow/month/year parity
+	if ( !GET(20) )	//start bit
 		return -1;
 
-
 	if ( !(GET(17) ^ GET(18)) )	//only one of Z1/Z2 should be set
 		return -1;
 
-	memset ( &dectime, 0, sizeof(dectime) );
+	//...but each field is checked on its own, so that a bad one can be filled in from the
+	//minutes before (see clkCompleteFields())
+	fields[CLK_FIELD_MINUTE] = dcf77GetBCD ( clock, 21, 7 );
+	valid[CLK_FIELD_MINUTE] = !clkDataErased ( clock, 21, 8 ) && !dcf77CheckParity ( clock, 21, 7, 28 )	//minutes parity
+		&& fields[CLK_FIELD_MINUTE] <= 59;
 
+	fields[CLK_FIELD_HOUR] = dcf77GetBCD ( clock, 29, 6 );
+	valid[CLK_FIELD_HOUR] = !clkDataErased ( clock, 29, 7 ) && !dcf77CheckParity ( clock, 29, 6, 35 )	//hours parity
+		&& fields[CLK_FIELD_HOUR] <= 23;
 
-	dectime.tm_year = dcf77GetBCD ( clock, 50, 8 ) + CENTURY - 1900;
-	dectime.tm_mon = dcf77GetBCD ( clock, 45, 5 ) - 1;
-	dectime.tm_mday = dcf77GetBCD ( clock, 36, 6 );
-	dectime.tm_wday = dcf77GetBCD ( clock, 42, 3 );
-	dectime.tm_hour = dcf77GetBCD ( clock, 29, 6 );
-	dectime.tm_min = dcf77GetBCD ( clock, 21, 7 );
-	dectime.tm_sec = 0;
-	dectime.tm_isdst = 0;	//decode as UTC, then correct for CET/CEST later
+	wday = dcf77GetBCD ( clock, 42, 3 );
+	fields[CLK_FIELD_DAY] = clkDayNumber ( dcf77GetBCD ( clock, 50, 8 ) + CENTURY - 1900,
+		dcf77GetBCD ( clock, 45, 5 ) - 1, dcf77GetBCD ( clock, 36, 6 ) );
+	valid[CLK_FIELD_DAY] = !clkDataErased ( clock, 36, 23 ) && !dcf77CheckParity ( clock, 36, 22, 58 )	//day/dow/month/year parity
+		&& wday >= 1 && wday <= 7 && fields[CLK_FIELD_DAY] >= 0;
 
-	if ( dectime.tm_wday == 7 )
-		dectime.tm_wday = 0;
+	//CET or CEST
+	utcoffset = GET(17) ? 2*60*60 : 1*60*60;
 
-	if ( dectime.tm_mon > 11 )
-		return -1;
-	if ( (dectime.tm_mday < 1) || (dectime.tm_mday > 31) )
-		return -1;
-	if ( dectime.tm_wday > 6 )
-		return -1;
-	if ( dectime.tm_hour > 23 )
-		return -1;
-	if ( dectime.tm_min > 60 )
+	dectimet = clkCompleteFields ( clock, fields, valid, utcoffset, minstart );
+	if ( dectimet == (time_t)(-1) )
 		return -1;
+
+	local = dectimet + utcoffset;
+	gmtime_r ( &local, &dectime );
+
 	/*                                   year mon  mday     wday hour min  TZ-info-leap-ant */
 	loggerf ( LOGGER_DEBUG, "DCF77 time: %04d-%02d-%02d (day %d) %02d:%02d %s%s%s%s\n",
 		dectime.tm_year+1900, dectime.tm_mon+1, dectime.tm_mday,
@@ -162,18 +158,6 @@ dcf77Decode ( clkInfoT* clock, time_f minstart )
 		GET(17) ? "CEST" : "CET", GET(16) ? " timezone change soon":"",
 		GET(19) ? " leap second soon":"", GET(15) ? " res ant" : " main ant" );
 
-
-//	setenv("TZ", "", 1);
-//
-//	dectimet = mktime ( &dectime );
-	dectimet = UTCtime ( &dectime );
-
-	if ( dectimet == (time_t)(-1) )
-		return -1;
-
-	//correct for DST offset...
-	dectimet -= GET(17) ? 2*60*60 : 1*60*60;
-
 	//right - the time seems OK now...
 
 	clock->pctime = minstart;
@@ -182,6 +166,76 @@ dcf77Decode ( clkInfoT* clock, time_f minstart )
 
 	clock->secondssincetime = 0;
 
+	//the seconds of the minute starting now should be...
+	clkLockMinute ( clock, dectimet, ( GET(17) ? CLK_ENCODE_DST : 0 ) | ( GET(16) ? CLK_ENCODE_DSTSOON : 0 )
+		| ( GET(19) ? CLK_ENCODE_LEAPSOON : 0 ), minstart );
+
 
 	return 0;
 }
+
+
+static int
+dcf77PutBCD ( signed char* data, int valstart, int valcount, int val )
+{
+	static const int BCD[8] = { 1, 2, 4, 8, 10, 20, 40, 80 };
+	int	parity, i;
+
+	parity = 0;
+	for ( i=valcount-1; i>=0; i-- )
+	{
+		if ( val >= BCD[i] )
+		{
+			val -= BCD[i];
+			data[valstart+i] = 2;
+			parity ^= 1;
+		}
+	}
+
+	return parity;
+}
+
+int
+dcf77Encode ( time_t minute, int flags, signed char* data )
+{
+	struct tm	enctime;
+	time_t		enctimet;
+	int		parity, i;
+
+	//each minute sends the (CET/CEST) time of the next one
+	enctimet = minute + 60 + ( (flags & CLK_ENCODE_DST) ? 2*60*60 : 1*60*60 );
+	gmtime_r ( &enctimet, &enctime );
+
+	for ( i=0; i<59; i++ )
+		data[i] = 1;
+
+	if ( flags & CLK_ENCODE_DSTSOON )
+		data[16] = 2;
+	data[(flags & CLK_ENCODE_DST) ? 17 : 18] = 2;
+	if ( flags & CLK_ENCODE_LEAPSOON )
+		data[19] = 2;
+	data[20] = 2;	//start bit
+
+	if ( dcf77PutBCD ( data, 21, 7, enctime.tm_min ) )
+		data[28] = 2;
+	if ( dcf77PutBCD ( data, 29, 6, enctime.tm_hour ) )
+		data[35] = 2;
+
+	parity = dcf77PutBCD ( data, 36, 6, enctime.tm_mday );
+	parity ^= dcf77PutBCD ( data, 42, 3, enctime.tm_wday ? enctime.tm_wday : 7 );
+	parity ^= dcf77PutBCD ( data, 45, 5, enctime.tm_mon + 1 );
+	parity ^= dcf77PutBCD ( data, 50, 8, enctime.tm_year % 100 );
+	if ( parity )
+		data[58] = 2;
+
+	//no pulse in the last second - a leap second is an extra 0 before it
+	if ( flags & CLK_ENCODE_LEAPSECOND )
+	{
+		data[59] = 1;
+		data[60] = 0;
+		return 61;
+	}
+
+	data[59] = 0;
+	return 60;
+}
@@ -4,6 +4,8 @@
 
 
 int dcf77Decode ( clkInfoT* clock, time_f minstart );
+//the seconds starting at minute (UTC) - returns how many
+int dcf77Encode ( time_t minute, int flags, signed char* data );
 
 
 #endif
@@ -123,9 +123,11 @@ msfDump ( clkInfoT* clock )
 int
 msfDecode ( clkInfoT* clock, time_f minstart )
 {
-//	int	year, month, mday, wday, hour, min;
 	struct tm	dectime;
-	time_t		dectimet;
+	time_t		dectimet, local;
+	int		fields[CLK_FIELDS];
+	int		valid[CLK_FIELDS];
+	int		utcoffset;
 
 	msfDump ( clock );
 
@@ -133,56 +135,38 @@ msfDecode ( clkInfoT* clock, time_f minstart )
 	if ( !DATA_OK(17) )
 		return -1;
 
-	//first, check that the parity bits make sense...
-
-	if ( !msfCheckParity ( clock, 17, 8, 54 ) )	//year...
+	if ( clkDataErased ( clock, 58, 1 ) )	//edges were missed in the BST bit
 		return -1;
 
-	if ( !msfCheckParity ( clock, 25, 11, 55 ) )	//month/month day...
-		return -1;
+	//each group of fields has its own parity bit, so is checked on its own - a bad one can be
+	//filled in from the minutes before (see clkCompleteFields())
 
-	if ( !msfCheckParity ( clock, 36, 3, 56 ) )	//day of week...
-		return -1;
-
-	if ( !msfCheckParity ( clock, 39, 13, 57 ) )	//hour/minute...
-		return -1;
-
-	memset ( &dectime, 0, sizeof(dectime) );
-
-	dectime.tm_year = msfGetBCDA ( clock, 17, 8 ) + CENTURY - 1900;
-	dectime.tm_mon = msfGetBCDA ( clock, 25, 5 ) - 1;
-	dectime.tm_mday = msfGetBCDA ( clock, 30, 6 );
-	dectime.tm_wday = msfGetBCDA ( clock, 36, 3 );
-	dectime.tm_hour = msfGetBCDA ( clock, 39, 6 );
-	dectime.tm_min = msfGetBCDA ( clock, 45, 7 );
-	dectime.tm_sec = 0;
-	dectime.tm_isdst = 0;	//decode as UTC, then correct for BST later...
-
-	//now do some sanity checks on the decoded time values...
-//TODO: check year value..
-	if ( dectime.tm_mon > 11 )
-		return -1;
-	if ( (dectime.tm_mday < 1) || (dectime.tm_mday > 31) )
-		return -1;
-	if ( dectime.tm_wday > 6 )
-		return -1;
-	if ( dectime.tm_hour > 23 )
-		return -1;
-	if ( dectime.tm_min > 60 )
-		return -1;
+	//hour/minute...
+	fields[CLK_FIELD_HOUR] = msfGetBCDA ( clock, 39, 6 );
+	fields[CLK_FIELD_MINUTE] = msfGetBCDA ( clock, 45, 7 );
+	valid[CLK_FIELD_HOUR] = !clkDataErased ( clock, 39, 13 ) && !clkDataErased ( clock, 57, 1 )
+		&& msfCheckParity ( clock, 39, 13, 57 ) && fields[CLK_FIELD_HOUR] <= 23 && fields[CLK_FIELD_MINUTE] <= 59;
+	valid[CLK_FIELD_MINUTE] = valid[CLK_FIELD_HOUR];
 
-	loggerf ( LOGGER_DEBUG, "MSF time: %04d-%02d-%02d (day %d) %02d:%02d %s%s\n", dectime.tm_year+1900, dectime.tm_mon, dectime.tm_mday, dectime.tm_wday, dectime.tm_hour, dectime.tm_min, GET_B(58) ? "BST" : "GMT", GET_B(53) ? " timezone change soon":"" );
+	//year, month/month day, and day of week...
+	fields[CLK_FIELD_DAY] = clkDayNumber ( msfGetBCDA ( clock, 17, 8 ) + CENTURY - 1900,
+		msfGetBCDA ( clock, 25, 5 ) - 1, msfGetBCDA ( clock, 30, 6 ) );
+	valid[CLK_FIELD_DAY] = !clkDataErased ( clock, 17, 22 ) && !clkDataErased ( clock, 54, 3 )
+		&& msfCheckParity ( clock, 17, 8, 54 ) && msfCheckParity ( clock, 25, 11, 55 )
+		&& msfCheckParity ( clock, 36, 3, 56 ) && msfGetBCDA ( clock, 36, 3 ) <= 6
+		&& fields[CLK_FIELD_DAY] >= 0;
 
-//	setenv("TZ", "", 1);
-//
-//	dectimet = mktime ( &dectime );
-	dectimet = UTCtime ( &dectime );
+	//GMT or BST
+	utcoffset = GET_B(58) ? 1*60*60 : 0*60*60;
 
+	dectimet = clkCompleteFields ( clock, fields, valid, utcoffset, minstart );
 	if ( dectimet == (time_t)(-1) )
 		return -1;
 
-	//correct for DST offset...
-	dectimet -= GET_B(58) ? 1*60*60 : 0*60*60;
+	local = dectimet + utcoffset;
+	gmtime_r ( &local, &dectime );
+
+	loggerf ( LOGGER_DEBUG, "MSF time: %04d-%02d-%02d (day %d) %02d:%02d %s%s\n", dectime.tm_year+1900, dectime.tm_mon+1, dectime.tm_mday, dectime.tm_wday, dectime.tm_hour, dectime.tm_min, GET_B(58) ? "BST" : "GMT", GET_B(53) ? " timezone change soon":"" );
 
 	//right - the time seems OK now...
 
@@ -192,7 +176,83 @@ msfDecode ( clkInfoT* clock, time_f minstart )
 
 	clock->secondssincetime = 0;
 
+	//the seconds of the minute starting now should be...
+	clkLockMinute ( clock, dectimet, ( GET_B(58) ? CLK_ENCODE_DST : 0 ) | ( GET_B(53) ? CLK_ENCODE_DSTSOON : 0 ), minstart );
+
 
 	return 0;
 }
 
+
+//A bits are 2 (or 3 with the B bit), B bits 11 (or 3 with the A bit) - see above
+#define	PUT_A(bit)	(data[bit] = (data[bit] == 11 || data[bit] == 3) ? 3 : 2)
+#define	PUT_B(bit)	(data[bit] = (data[bit] == 2 || data[bit] == 3) ? 3 : 11)
+
+static int
+msfPutBCDA ( signed char* data, int valstart, int valcount, int val )
+{
+	static const int BCD[8] = { 80, 40, 20, 10, 8, 4, 2, 1 };
+	int	parity, i;
+
+	parity = 0;
+	for ( i=0; i<valcount; i++ )
+	{
+		if ( val >= BCD[8 - valcount + i] )
+		{
+			val -= BCD[8 - valcount + i];
+			PUT_A(valstart+i);
+			parity ^= 1;
+		}
+	}
+
+	return parity;
+}
+
+int
+msfEncode ( time_t minute, int flags, signed char* data )
+{
+	struct tm	enctime;
+	time_t		enctimet;
+	int		i, n;
+
+	//each minute sends the (GMT/BST) time of the next one
+	enctimet = minute + 60 + ( (flags & CLK_ENCODE_DST) ? 1*60*60 : 0 );
+	gmtime_r ( &enctimet, &enctime );
+
+	//(a leap second is an extra 0 before the last second)
+	n = (flags & CLK_ENCODE_LEAPSECOND) ? 61 : 60;
+
+	data[0] = 5;	//minute marker
+	for ( i=1; i<n; i++ )
+		data[i] = 1;
+
+	//odd parity - with the B bits in 54-57
+	if ( !msfPutBCDA ( data, 17, 8, enctime.tm_year % 100 ) )
+		PUT_B(54);
+	if ( !(msfPutBCDA ( data, 25, 5, enctime.tm_mon + 1 ) ^ msfPutBCDA ( data, 30, 6, enctime.tm_mday )) )
+		PUT_B(55);
+	if ( !msfPutBCDA ( data, 36, 3, enctime.tm_wday ) )
+		PUT_B(56);
+	if ( !(msfPutBCDA ( data, 39, 6, enctime.tm_hour ) ^ msfPutBCDA ( data, 45, 7, enctime.tm_min )) )
+		PUT_B(57);
+
+	//the minute identifier 01111110 in the A bits of 52-59
+	for ( i=53; i<59; i++ )
+		PUT_A(i);
+
+	if ( flags & CLK_ENCODE_DSTSOON )
+		PUT_B(53);
+	if ( flags & CLK_ENCODE_DST )
+		PUT_B(58);
+
+	//the extra second comes before the last one
+	if ( n == 61 )
+	{
+		for ( i=59; i>=52; i-- )
+			data[i+1] = data[i];
+		data[52] = 1;
+	}
+
+	return n;
+}
+
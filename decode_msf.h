@@ -5,5 +5,7 @@
 
 
 int msfDecode ( clkInfoT* clock, time_f minstart );
+//the seconds starting at minute (UTC) - returns how many
+int msfEncode ( time_t minute, int flags, signed char* data );
 
 #endif
@@ -61,7 +61,12 @@ wwvbGetBCD ( clkInfoT* clock, int valstart, int valcount )
 	for ( i=0; i<valcount; i++ )
 	{
 		if ( GET(valstart+i) )
+		{
+			//the unused bits (and markers) inside a field are never set
+			if ( BCD [ 12 - valcount + i ] == 0 )
+				return -1;
 			val += BCD [ 12 - valcount + i ];
+		}
 	}
 
 	return val;
@@ -87,31 +92,42 @@ wwvbDump ( clkInfoT* clock )
 int
 wwvbDecode ( clkInfoT* clock, time_f minstart )
 {
+	static const int markers[7] = { 0, 9, 19, 29, 39, 49, 59 };
 	struct tm	dectime;
 	time_t		dectimet;
+	int		fields[CLK_FIELDS];
+	int		valid[CLK_FIELDS];
+	int		i;
 
 	wwvbDump ( clock );
 
 	if ( !DATA_OK(1) )
 		return -1;
 
-	memset ( &dectime, 0, sizeof(dectime) );
+	//the markers are in the same places every minute - if one isn't, the seconds are out of step
+	for ( i=0; i<7; i++ )
+	{
+		if ( DATA_OK(markers[i]) && GET_DATA(markers[i]) != 8 && GET_DATA(markers[i]) != CLK_DATA_ERASED )
+			return -1;
+	}
 
-	dectime.tm_year = wwvbGetBCD ( clock, 44, 10 ) + CENTURY - 1900;
-	dectime.tm_mon = 0;
-	dectime.tm_mday = wwvbGetBCD ( clock, 22, 12 );
-	dectime.tm_hour = wwvbGetBCD ( clock, 12, 7 );
-	dectime.tm_min = wwvbGetBCD ( clock, 1, 8 ) + 1;
-	dectime.tm_sec = 0;
-	dectime.tm_isdst = 0;	//time is always UTC... (although there are bits for summer time)
+	//there's no parity - each field is checked by its range and unused bits, and a bad one can
+	//be filled in from the minutes before (see clkCompleteFields())
+	fields[CLK_FIELD_MINUTE] = wwvbGetBCD ( clock, 1, 8 );
+	valid[CLK_FIELD_MINUTE] = !clkDataErased ( clock, 1, 8 ) && fields[CLK_FIELD_MINUTE] >= 0 && fields[CLK_FIELD_MINUTE] <= 59;
 
-	//NOTE: decoding this depends on a mktime() which will normalize day numbers correctly
+	fields[CLK_FIELD_HOUR] = wwvbGetBCD ( clock, 12, 7 );
+	valid[CLK_FIELD_HOUR] = !clkDataErased ( clock, 12, 7 ) && fields[CLK_FIELD_HOUR] >= 0 && fields[CLK_FIELD_HOUR] <= 23;
 
-	if ( (dectime.tm_mday < 1) || (dectime.tm_mday > 366) )
-		return -1;
-	if ( dectime.tm_hour > 23 )
-		return -1;
-	if ( dectime.tm_min > 60 )
+	//NOTE: the day of the year is normalized into a date by UTCtime()
+	fields[CLK_FIELD_DAY] = -1;
+	if ( wwvbGetBCD ( clock, 22, 12 ) >= 0 && wwvbGetBCD ( clock, 44, 10 ) >= 0 )
+		fields[CLK_FIELD_DAY] = clkDayNumber ( wwvbGetBCD ( clock, 44, 10 ) + CENTURY - 1900, 0, wwvbGetBCD ( clock, 22, 12 ) );
+	valid[CLK_FIELD_DAY] = !clkDataErased ( clock, 22, 12 ) && !clkDataErased ( clock, 44, 10 ) && fields[CLK_FIELD_DAY] >= 0;
+
+	//(time is always UTC... although there are bits for summer time)
+	dectimet = clkCompleteFields ( clock, fields, valid, 0, minstart );
+	if ( dectimet == (time_t)(-1) )
 		return -1;
 
         /*
@@ -119,19 +135,11 @@ wwvbDecode ( clkInfoT* clock, time_f minstart )
                 and THEN the time at that marker. So, we need to always move the
                 time forward one minute to be correct.
         */
-	if ( dectime.tm_min == 60 ) {
-		dectime.tm_min = 0;
-		dectime.tm_hour++;
-		if ( dectime.tm_hour > 23 ) {
-			dectime.tm_hour = 0;
-		}
-	}
+	dectimet += 60;
 
-	loggerf ( LOGGER_DEBUG, "WWVB time: %04d-%03d %02d:%02d %s%s\n", dectime.tm_year+1900, dectime.tm_mday, dectime.tm_hour, dectime.tm_min, GET(55)?" leap year":"", GET(56)?" leap second soon":"" );
+	gmtime_r ( &dectimet, &dectime );
 
-	dectimet = UTCtime ( &dectime );
-	if ( dectimet == (time_t)(-1) )
-		return -1;
+	loggerf ( LOGGER_DEBUG, "WWVB time: %04d-%03d %02d:%02d %s%s\n", dectime.tm_year+1900, dectime.tm_yday+1, dectime.tm_hour, dectime.tm_min, GET(55)?" leap year":"", GET(56)?" leap second soon":"" );
 
 	clock->pctime = minstart;
 	clock->radiotime = dectimet + clock->fudgeoffset;
@@ -139,5 +147,70 @@ wwvbDecode ( clkInfoT* clock, time_f minstart )
 
 	clock->secondssincetime = 0;
 
+	//the seconds of the minute starting now should be...
+	clkLockMinute ( clock, dectimet, ( GET(58) ? CLK_ENCODE_DST : 0 ) | ( GET(57) != GET(58) ? CLK_ENCODE_DSTSOON : 0 )
+		| ( GET(56) ? CLK_ENCODE_LEAPSOON : 0 ), minstart );
+
 	return 0;
 }
+
+
+//weights of the bits in a BCD field - the 0s are unused bits, inside the field
+static int
+wwvbPutBCD ( signed char* data, int valstart, int valcount, int val )
+{
+	static const int BCD[12] = { 200, 100, 0, 80, 40, 20, 10, 0, 8, 4, 2, 1 };
+	int	i;
+
+	if ( valcount > 12 )
+		return -1;
+
+	for ( i=0; i<valcount; i++ )
+	{
+		if ( BCD[12 - valcount + i] != 0 && val >= BCD[12 - valcount + i] )
+		{
+			val -= BCD[12 - valcount + i];
+			data[valstart+i] = 5;
+		}
+	}
+
+	return 0;
+}
+
+//(WWVB sends UTC. DST is summer time at the start of the UTC day, and DSTSOON a change
+//during it)
+int
+wwvbEncode ( time_t minute, int flags, signed char* data )
+{
+	struct tm	enctime;
+	int		year, n, i;
+
+	//each minute sends its own time, after the marker
+	gmtime_r ( &minute, &enctime );
+
+	n = (flags & CLK_ENCODE_LEAPSECOND) ? 61 : 60;
+
+	for ( i=0; i<n; i++ )
+		data[i] = 2;
+
+	for ( i=0; i<60; i+=10 )
+		data[i == 0 ? 0 : i-1] = 8;	//markers at 0, 9, 19, ... 49
+	data[n-1] = 8;
+
+	wwvbPutBCD ( data, 1, 8, enctime.tm_min );
+	wwvbPutBCD ( data, 12, 7, enctime.tm_hour );
+	wwvbPutBCD ( data, 22, 12, enctime.tm_yday + 1 );
+	wwvbPutBCD ( data, 44, 10, enctime.tm_year % 100 );
+
+	year = enctime.tm_year + 1900;
+	if ( (year % 4 == 0 && year % 100 != 0) || year % 400 == 0 )
+		data[55] = 5;
+	if ( flags & CLK_ENCODE_LEAPSOON )
+		data[56] = 5;
+	if ( (flags & CLK_ENCODE_DST) ^ ((flags & CLK_ENCODE_DSTSOON) ? CLK_ENCODE_DST : 0) )
+		data[57] = 5;
+	if ( flags & CLK_ENCODE_DST )
+		data[58] = 5;
+
+	return n;
+}
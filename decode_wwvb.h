@@ -5,5 +5,7 @@
 
 
 int wwvbDecode ( clkInfoT* clock, time_f minstart );
+//the seconds starting at minute (UTC) - returns how many
+int wwvbEncode ( time_t minute, int flags, signed char* data );
 
 #endif
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2002 Jon Atkins http://www.jonatkins.com/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#ifdef ENABLE_DISCIPLINE
+
+#include <sys/timex.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "discipline.h"
+#include "shm.h"
+#include "timef.h"
+#include "logger.h"
+
+#ifndef ADJ_SETOFFSET
+#define ADJ_SETOFFSET	0x0100	//(kernel 2.6.39, before the headers had it)
+#endif
+
+//the first time, the clock is stepped if it's further out than this (it would take 4s to
+//slew), and after that only if it's as far out as ntpd would step it
+#define	DISC_FIRSTSTEP	(0.002)
+#define	DISC_STEP	(0.128)
+//the kernel's frequency range, and its units (ppm, 16 bits fraction)
+#define	DISC_MAXFREQ	(500e-6)
+#define	DISC_FREQSCALE	(65536e6)
+//the kernel slews at this rate
+#define	DISC_SLEWRATE	(500e-6)
+
+static const discOpsT*	discOps;
+static int		discStarted;
+
+
+//-- the kernel clock
+
+static int
+discKernelAdjtime ( struct timex* tx )
+{
+	return adjtimex ( tx );
+}
+
+static time_f
+discKernelReadTime ( time_f timef )
+{
+	return timef;
+}
+
+const discOpsT discKernel = { "kernel", discKernelAdjtime, discKernelReadTime };
+
+
+//-- the mock clock: the undisciplined time, plus a phase that moves at the frequency set and
+//   the rate of any slew
+
+static time_f	discMockLast;	//the undisciplined time the phase was moved to
+static time_f	discMockPhase;
+static time_f	discMockFreq;
+static time_f	discMockSlew;	//still to slew
+static int	discMockStatus;
+
+static void
+discMockMove ( time_f timef )
+{
+	time_f	dt, slew;
+
+	if ( discMockLast == 0 || timef <= discMockLast )
+	{
+		if ( discMockLast == 0 )
+			discMockLast = timef;
+		return;
+	}
+
+	dt = timef - discMockLast;
+	discMockPhase += discMockFreq * dt;
+
+	slew = DISC_SLEWRATE * dt;
+	if ( fabs ( discMockSlew ) < slew )
+		slew = fabs ( discMockSlew );
+	slew = discMockSlew < 0 ? -slew : slew;
+	discMockPhase += slew;
+	discMockSlew -= slew;
+
+	discMockLast = timef;
+}
+
+static int
+discMockAdjtime ( struct timex* tx )
+{
+	time_f	step;
+
+	if ( tx->modes == ADJ_OFFSET_SINGLESHOT )
+	{
+		discMockSlew = tx->offset / 1000000.0;
+		loggerf ( LOGGER_DEBUG, "disc: mock slew "TIMEF_FORMAT"\n", discMockSlew );
+	}
+	if ( tx->modes & ADJ_SETOFFSET )
+	{
+		step = tx->time.tv_sec + tx->time.tv_usec / ( tx->modes & ADJ_NANO ? 1000000000.0 : 1000000.0 );
+		discMockPhase += step;
+		loggerf ( LOGGER_DEBUG, "disc: mock step "TIMEF_FORMAT"\n", step );
+	}
+	if ( tx->modes & ADJ_FREQUENCY )
+	{
+		discMockFreq = tx->freq / DISC_FREQSCALE;
+		loggerf ( LOGGER_DEBUG, "disc: mock frequency %+.3fppm\n", discMockFreq * 1e6 );
+	}
+	if ( tx->modes & ADJ_STATUS )
+		discMockStatus = tx->status;
+
+	tx->freq = discMockFreq * DISC_FREQSCALE;
+	tx->offset = discMockSlew * 1000000.0;
+	tx->status = discMockStatus;
+
+	return discMockStatus & STA_INS ? TIME_INS : discMockStatus & STA_DEL ? TIME_DEL : TIME_OK;
+}
+
+static time_f
+discMockReadTime ( time_f timef )
+{
+	discMockMove ( timef );
+	return timef + discMockPhase;
+}
+
+const discOpsT discMock = { "mock", discMockAdjtime, discMockReadTime };
+
+
+//--
+
+void
+discInit ( const discOpsT* ops )
+{
+	discOps = ops;
+	discStarted = 0;
+
+	loggerf ( LOGGER_INFO, "Disciplining the %s clock\n", ops->name );
+}
+
+int
+discUpdate ( time_f offset, time_f err, time_f freq, int leap, time_f* pstep, time_f* pfreq )
+{
+	struct timex	tx;
+	time_f		oldfreq, newfreq, step;
+	int		stepped;
+
+	*pstep = 0;
+	*pfreq = 0;
+
+	memset ( &tx, 0, sizeof(tx) );
+	if ( discOps->adjtime ( &tx ) < 0 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: failed to read the %s clock: %s\n", discOps->name, strerror ( errno ) );
+		return -1;
+	}
+
+	//the frequency error the filter has measured is taken off the clock's - which leaves the
+	//kernel's PLL off, as each minute's offset is already known to far better than it would
+	//average it to
+	oldfreq = tx.freq / DISC_FREQSCALE;
+	newfreq = oldfreq - freq;
+	if ( newfreq > DISC_MAXFREQ )
+		newfreq = DISC_MAXFREQ;
+	if ( newfreq < -DISC_MAXFREQ )
+		newfreq = -DISC_MAXFREQ;
+
+	memset ( &tx, 0, sizeof(tx) );
+	tx.modes = ADJ_FREQUENCY | ADJ_STATUS | ADJ_ESTERROR | ADJ_MAXERROR;
+	tx.freq = newfreq * DISC_FREQSCALE;
+	//(and it's in sync - with any leap second announced)
+	tx.status = leap == LEAP_ADDSECOND ? STA_INS : leap == LEAP_DELSECOND ? STA_DEL : 0;
+	tx.esterror = err * 1000000.0;
+	tx.maxerror = ( fabs ( offset ) + err ) * 1000000.0;
+	if ( discOps->adjtime ( &tx ) < 0 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: failed to set the %s clock's frequency: %s\n", discOps->name, strerror ( errno ) );
+		return -1;
+	}
+	*pfreq = newfreq - oldfreq;
+
+	//then the offset is taken off
+	step = -offset;
+	stepped = fabs ( offset ) > ( discStarted ? DISC_STEP : DISC_FIRSTSTEP );
+	memset ( &tx, 0, sizeof(tx) );
+	if ( stepped )
+	{
+		tx.modes = ADJ_SETOFFSET | ADJ_NANO;
+		tx.time.tv_sec = floor ( step );
+		tx.time.tv_usec = floor ( ( step - tx.time.tv_sec ) * 1000000000.0 + 0.5 );
+		if ( tx.time.tv_usec >= 1000000000 )
+		{
+			tx.time.tv_sec++;
+			tx.time.tv_usec -= 1000000000;
+		}
+	}
+	else
+	{
+		tx.modes = ADJ_OFFSET_SINGLESHOT;
+		tx.offset = floor ( step * 1000000.0 + 0.5 );
+		step = tx.offset / 1000000.0;
+	}
+	if ( discOps->adjtime ( &tx ) < 0 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: failed to %s the %s clock: %s\n", stepped ? "step" : "slew", discOps->name, strerror ( errno ) );
+		return -1;
+	}
+	*pstep = step;
+
+	if ( stepped )
+		loggerf ( LOGGER_INFO, "Stepped the %s clock by "TIMEF_FORMAT"\n", discOps->name, step );
+	loggerf ( LOGGER_DEBUG, "disc: offset "TIMEF_FORMAT" +-"TIMEF_FORMAT", frequency %+.3fppm, %s "TIMEF_FORMAT"\n",
+		offset, err, newfreq * 1e6, stepped ? "stepped" : "slewing", step );
+
+	discStarted = 1;
+
+	return stepped;
+}
+
+time_f
+discReadTime ( time_f timef )
+{
+	return discOps != NULL ? discOps->readtime ( timef ) : timef;
+}
+
+#endif
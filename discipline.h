@@ -0,0 +1,40 @@
+#ifndef DISCIPLINE_H_
+#define DISCIPLINE_H_
+
+#include "config.h"
+
+#ifdef ENABLE_DISCIPLINE
+
+#include <sys/timex.h>
+
+#include "timef.h"
+
+
+//the calls the kernel clock is disciplined through - adjtimex() itself, or a mock clock that
+//only pretends to be changed (for replays, which must never touch the real one)
+typedef struct {
+	const char*	name;
+	//as adjtimex() - makes the changes in tx->modes, and returns the clock's state in tx
+	int	(*adjtime) ( struct timex* tx );
+	//the time the clock reads at timef on the undisciplined one (timef, for the kernel)
+	time_f	(*readtime) ( time_f timef );
+} discOpsT;
+
+extern const discOpsT discKernel;
+extern const discOpsT discMock;
+
+
+void discInit ( const discOpsT* ops );
+
+//the clock is offset (pc less the true time) +-err, and runs fast by freq - its frequency is
+//corrected, and then it is slewed, or stepped if it's too far out. What was done is returned
+//(*pstep is added to the clock, *pfreq to its frequency) for the measurements to be moved by
+//as much - with 1 if the clock was stepped, 0 if slewed, or -1 on an error
+int discUpdate ( time_f offset, time_f err, time_f freq, int leap, time_f* pstep, time_f* pfreq );
+
+//a time on the undisciplined clock (a replayed edge), as the clock being disciplined reads it
+time_f discReadTime ( time_f timef );
+
+#endif
+
+#endif
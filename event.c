@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2002 Jon Atkins http://www.jonatkins.com/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <math.h>
+#include "systime.h"
+
+#ifdef ENABLE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
+#include <poll.h>
+#endif
+
+#include "event.h"
+#include "logger.h"
+#include "memory.h"
+
+
+struct evtSourceS
+{
+	evtSourceT*	next;
+
+	//file descriptor sources...
+	int		fd;
+	int		events;
+
+	//timer sources - deadline is 0 when the timer isn't armed
+	time_f		deadline;
+	time_f		interval;
+
+	evtCallbackT	callback;
+	void*		arg;
+};
+
+#define	EVT_MAX_WAIT	(16)
+
+static evtSourceT*	evtHead;
+
+#ifdef ENABLE_EPOLL
+static int	evtEpollFd = -1;
+//a single timerfd is armed for the earliest timer deadline
+static int	evtTimerFd = -1;
+static time_f	evtTimerArmed;
+#endif
+
+
+time_f
+evtNow (void)
+{
+	time_f	now;
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_MONOTONIC)
+	struct timespec	ts;
+
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+	timespec2time_f ( &ts, now );
+#else
+	struct timeval	tv;
+
+	gettimeofday ( &tv, NULL );
+	timeval2time_f ( &tv, now );
+#endif
+	return now;
+}
+
+
+int
+evtInit (void)
+{
+#ifdef ENABLE_EPOLL
+	struct epoll_event	ev;
+#endif
+
+	evtHead = NULL;
+
+#ifdef ENABLE_EPOLL
+	evtEpollFd = epoll_create ( EVT_MAX_WAIT );
+	if ( evtEpollFd < 0 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: epoll_create() failed: %s\n", strerror(errno) );
+		return -1;
+	}
+
+	evtTimerFd = timerfd_create ( CLOCK_MONOTONIC, 0 );
+	if ( evtTimerFd < 0 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: timerfd_create() failed: %s\n", strerror(errno) );
+		return -1;
+	}
+	evtTimerArmed = 0;
+
+	memset ( &ev, 0, sizeof(ev) );
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;	//NULL marks the timer fd
+	if ( epoll_ctl ( evtEpollFd, EPOLL_CTL_ADD, evtTimerFd, &ev ) != 0 )
+		return -1;
+#endif
+
+	return 0;
+}
+
+
+static evtSourceT*
+evtNewSource ( int fd, int events, evtCallbackT callback, void* arg )
+{
+	evtSourceT*	src;
+
+	src = safe_mallocz ( sizeof(evtSourceT) );
+	src->next = evtHead;
+	evtHead = src;
+
+	src->fd = fd;
+	src->events = events;
+	src->callback = callback;
+	src->arg = arg;
+
+	return src;
+}
+
+evtSourceT*
+evtAddFd ( int fd, int events, evtCallbackT callback, void* arg )
+{
+	evtSourceT*	src;
+#ifdef ENABLE_EPOLL
+	struct epoll_event	ev;
+#endif
+
+	if ( fd < 0 )
+		return NULL;
+
+	src = evtNewSource ( fd, events, callback, arg );
+
+#ifdef ENABLE_EPOLL
+	memset ( &ev, 0, sizeof(ev) );
+	if ( events & EVT_READ )
+		ev.events |= EPOLLIN;
+	if ( events & EVT_PRIORITY )
+		ev.events |= EPOLLPRI | EPOLLERR;
+	ev.data.ptr = src;
+
+	if ( epoll_ctl ( evtEpollFd, EPOLL_CTL_ADD, fd, &ev ) != 0 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: epoll_ctl() failed for fd %d: %s\n", fd, strerror(errno) );
+		//the new source is still at the head of the list
+		evtHead = src->next;
+		safe_free ( src );
+		return NULL;
+	}
+#endif
+
+	return src;
+}
+
+evtSourceT*
+evtAddTimer ( evtCallbackT callback, void* arg )
+{
+	return evtNewSource ( -1, 0, callback, arg );
+}
+
+void
+evtSetTimer ( evtSourceT* src, time_f delay, time_f interval )
+{
+	src->deadline = evtNow() + delay;
+	src->interval = interval;
+}
+
+void
+evtSetTimerAt ( evtSourceT* src, time_f when )
+{
+	src->deadline = when;
+	src->interval = 0;
+}
+
+void
+evtStopTimer ( evtSourceT* src )
+{
+	src->deadline = 0;
+	src->interval = 0;
+}
+
+
+//run any expired timers, and return the next timer deadline (or 0 if none are armed)
+static time_f
+evtRunTimers (void)
+{
+	evtSourceT*	src;
+	time_f		now;
+	time_f		next;
+
+	now = evtNow();
+
+	for ( src = evtHead; src != NULL; src = src->next )
+	{
+		if ( src->fd >= 0 || src->deadline == 0 || src->deadline > now )
+			continue;
+
+		if ( src->interval > 0 )
+		{
+			src->deadline += src->interval;
+			//if we've fallen behind, don't try and catch up on the missed ticks
+			if ( src->deadline <= now )
+				src->deadline = now + src->interval;
+		}
+		else
+			src->deadline = 0;
+
+		src->callback ( src, src->arg );
+	}
+
+	//the callbacks may have re-armed timers, so look again...
+	next = 0;
+	for ( src = evtHead; src != NULL; src = src->next )
+	{
+		if ( src->fd >= 0 || src->deadline == 0 )
+			continue;
+		if ( next == 0 || src->deadline < next )
+			next = src->deadline;
+	}
+
+	return next;
+}
+
+
+#ifdef ENABLE_EPOLL
+
+int
+evtRun (void)
+{
+	struct epoll_event	events[EVT_MAX_WAIT];
+	struct itimerspec	its;
+	evtSourceT*		src;
+	uint64_t		expirations;
+	time_f			next;
+	int			i, n;
+
+	while ( 1 )
+	{
+		next = evtRunTimers ();
+
+		if ( next != evtTimerArmed )
+		{
+			//a zero it_value disarms the timer
+			memset ( &its, 0, sizeof(its) );
+			if ( next != 0 )
+				time_f2timespec ( next, &its.it_value );
+			timerfd_settime ( evtTimerFd, TFD_TIMER_ABSTIME, &its, NULL );
+			evtTimerArmed = next;
+		}
+
+		n = epoll_wait ( evtEpollFd, events, EVT_MAX_WAIT, -1 );
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			loggerf ( LOGGER_NOTE, "Error: epoll_wait() failed: %s\n", strerror(errno) );
+			return -1;
+		}
+
+		for ( i=0; i<n; i++ )
+		{
+			src = events[i].data.ptr;
+			if ( src == NULL )
+			{
+				//timer expired - the timers are run at the top of the loop
+				if ( read ( evtTimerFd, &expirations, sizeof(expirations) ) < 0 && errno != EAGAIN && errno != EINTR )
+					loggerf ( LOGGER_DEBUG, "Error: read() of timerfd failed: %s\n", strerror(errno) );
+				evtTimerArmed = 0;
+				continue;
+			}
+
+			src->callback ( src, src->arg );
+		}
+	}
+
+	return -1;
+}
+
+#else
+
+int
+evtRun (void)
+{
+	struct pollfd	pollfds[EVT_MAX_WAIT];
+	evtSourceT*	pollsrc[EVT_MAX_WAIT];
+	evtSourceT*	src;
+	time_f		next;
+	int		timeout;
+	int		i, n;
+
+	while ( 1 )
+	{
+		next = evtRunTimers ();
+
+		timeout = -1;
+		if ( next != 0 )
+		{
+			timeout = (int)ceil ( (next - evtNow()) * 1000.0 );
+			if ( timeout < 0 )
+				timeout = 0;
+		}
+
+		n = 0;
+		for ( src = evtHead; src != NULL && n < EVT_MAX_WAIT; src = src->next )
+		{
+			if ( src->fd < 0 )
+				continue;
+
+			pollfds[n].fd = src->fd;
+			pollfds[n].events = 0;
+			pollfds[n].revents = 0;
+			if ( src->events & EVT_READ )
+				pollfds[n].events |= POLLIN;
+			if ( src->events & EVT_PRIORITY )
+				pollfds[n].events |= POLLPRI;
+			pollsrc[n] = src;
+			n++;
+		}
+
+		if ( poll ( pollfds, n, timeout ) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			loggerf ( LOGGER_NOTE, "Error: poll() failed: %s\n", strerror(errno) );
+			return -1;
+		}
+
+		for ( i=0; i<n; i++ )
+		{
+			if ( pollfds[i].revents != 0 )
+				pollsrc[i]->callback ( pollsrc[i], pollsrc[i]->arg );
+		}
+	}
+
+	return -1;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef EVENT_H_
+#define EVENT_H_
+
+#include "timef.h"
+
+
+//the event loop waits on all of the acquisition sources at once, in a single process.
+//an event source (evtSourceT) is either a file descriptor or a timer - each serial
+//port mode plugs in one or more of these, rather than sitting in its own wait loop
+
+typedef struct evtSourceS evtSourceT;
+
+typedef void (*evtCallbackT) ( evtSourceT* src, void* arg );
+
+//what to wait for on a file descriptor
+#define	EVT_READ	(1)
+#define	EVT_PRIORITY	(2)	//urgent/exceptional data - used by the sysfs gpio value file
+
+
+int evtInit (void);
+
+evtSourceT* evtAddFd ( int fd, int events, evtCallbackT callback, void* arg );
+evtSourceT* evtAddTimer ( evtCallbackT callback, void* arg );
+
+//arm a timer to fire after delay seconds, then every interval seconds (0 for a one-shot)
+void evtSetTimer ( evtSourceT* src, time_f delay, time_f interval );
+//arm a one-shot timer to fire at a time from evtNow()
+void evtSetTimerAt ( evtSourceT* src, time_f when );
+void evtStopTimer ( evtSourceT* src );
+
+//monotonic time used for all timers (not the wall clock)
+time_f evtNow (void);
+
+//run the event loop - only returns on an error
+int evtRun (void);
+
+
+#endif
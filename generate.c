@@ -0,0 +1,529 @@
+/*
+ * Copyright (c) 2002 Jon Atkins http://www.jonatkins.com/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+//radioclkgen - generates the edges a receiver would give for a range of minutes, with
+//noise, as a capture file - for radioclkd2 -s replay:FILE (see capfile.h)
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/ioctl.h>
+#include "systime.h"
+
+#include "clock.h"
+#include "decode_dcf77.h"
+#include "decode_msf.h"
+#include "decode_wwvb.h"
+#include "capfile.h"
+#include "utctime.h"
+
+
+#if !HAVE_STRCASECMP
+# if HAVE_STRICMP
+#  define strcasecmp(a,b) stricmp((a),(b))
+# else
+#  define strcasecmp(a,b) strcmpi((a),(b))
+# endif
+#endif
+
+
+//the most edges in a minute - 61 seconds of 2 pulses, and a glitch
+#define	GEN_MAX_EDGES	(61*6)
+
+
+//-- random numbers (xorshift64*) - the same seed always gives the same edges
+
+static uint64_t	genRandState = 88172645463325252ULL;
+
+static double
+genRandom (void)
+{
+	genRandState ^= genRandState >> 12;
+	genRandState ^= genRandState << 25;
+	genRandState ^= genRandState >> 27;
+
+	return (double)((genRandState * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+}
+
+static double
+genGaussian (void)
+{
+	double	u1, u2;
+
+	do
+		u1 = genRandom ();
+	while ( u1 <= 0 );
+	u2 = genRandom ();
+
+	return sqrt ( -2.0 * log ( u1 ) ) * cos ( 2.0 * M_PI * u2 );
+}
+
+
+//-- summer time rules
+
+//midnight UTC on a date (mday 0 is the last day of the month before)
+static time_t
+genDate ( int year, int mon, int mday, struct tm* tm )
+{
+	time_t	t;
+
+	memset ( tm, 0, sizeof(*tm) );
+	tm->tm_year = year - 1900;
+	tm->tm_mon = mon;
+	tm->tm_mday = mday;
+	t = UTCtime ( tm );
+	gmtime_r ( &t, tm );
+
+	return t;
+}
+
+//EU summer time (DCF77 and MSF) - 01:00 UTC on the last sunday in march, to 01:00 UTC
+//on the last sunday in october
+static int
+genEuSummer ( time_t t )
+{
+	struct tm	tm;
+	time_t		start, end;
+	int		year;
+
+	gmtime_r ( &t, &tm );
+	year = tm.tm_year + 1900;
+
+	start = genDate ( year, 3, 0, &tm );
+	start -= tm.tm_wday * 24*60*60 - 60*60;
+	end = genDate ( year, 10, 0, &tm );
+	end -= tm.tm_wday * 24*60*60 - 60*60;
+
+	return t >= start && t < end;
+}
+
+//US summer time (WWVB) at the start of a UTC day - from the second sunday in march to
+//the first sunday in november (which change at 2am local, later in the UTC day)
+static int
+genUsSummer ( time_t t, int* changeday )
+{
+	struct tm	tm;
+	int		year, yday, mar, nov;
+
+	gmtime_r ( &t, &tm );
+	year = tm.tm_year + 1900;
+	yday = tm.tm_yday;
+
+	genDate ( year, 2, 1, &tm );
+	mar = tm.tm_yday + (7 - tm.tm_wday) % 7 + 7;
+	genDate ( year, 10, 1, &tm );
+	nov = tm.tm_yday + (7 - tm.tm_wday) % 7;
+
+	*changeday = ( yday == mar || yday == nov );
+
+	return yday > mar && yday <= nov;
+}
+
+
+//-- settings
+
+static int	genClockType = CLOCKTYPE_DCF77;
+static time_t	genStart;
+static int	genMinutes = 60;
+static time_t	genLeapMinute;		//the minute that ends with a leap second (or 0)
+
+static time_f	genDelay;		//receiver delay
+static time_f	genDrift;		//the pc clock gains this much each second (ppm/1e6)
+static time_f	genJitter;		//standard deviation of each edge
+static double	genDropProb;		//chance of a second's pulse going missing
+static double	genGlitchProb;		//chance of a spike in a second
+static time_f	genStretch;		//the receiver makes each pulse this much longer
+static double	genFadeProb;		//chance of the signal fading out in a second...
+static int	genFadeSeconds;		//...for this many seconds
+static int	genFadeLeft;
+
+static char*	genDevName = "/dev/gen";
+
+
+//the flags for encoding a minute, as each station sends them
+static int
+genFlags ( time_t minute )
+{
+	struct tm	tm;
+	time_t		leapwarn;
+	int		flags, changeday;
+
+	flags = 0;
+	leapwarn = 0;
+
+	switch ( genClockType )
+	{
+	case CLOCKTYPE_DCF77:
+	case CLOCKTYPE_MSF:
+		//the time sent is for the next minute - the warning is for an hour before
+		if ( genEuSummer ( minute + 60 ) )
+			flags |= CLK_ENCODE_DST;
+		if ( genEuSummer ( minute + 60 ) != genEuSummer ( minute + 60 + 60*60 ) )
+			flags |= CLK_ENCODE_DSTSOON;
+
+		//(MSF has no leap second warning)
+		if ( genClockType == CLOCKTYPE_DCF77 && genLeapMinute != 0 )
+			leapwarn = genLeapMinute + 60 - 60*60;
+		break;
+
+	case CLOCKTYPE_WWVB:
+		if ( genUsSummer ( minute, &changeday ) )
+			flags |= CLK_ENCODE_DST;
+		if ( changeday )
+			flags |= CLK_ENCODE_DSTSOON;
+
+		//warned from the start of the month
+		if ( genLeapMinute != 0 )
+		{
+			gmtime_r ( &genLeapMinute, &tm );
+			leapwarn = genDate ( tm.tm_year + 1900, tm.tm_mon, 1, &tm );
+		}
+		break;
+	}
+
+	if ( genLeapMinute != 0 && minute >= leapwarn && minute <= genLeapMinute && leapwarn != 0 )
+		flags |= CLK_ENCODE_LEAPSOON;
+	if ( genLeapMinute != 0 && minute == genLeapMinute )
+		flags |= CLK_ENCODE_LEAPSECOND;
+
+	return flags;
+}
+
+
+//add the low pulses for one second, starting at timef - each edge toggles the level
+static int
+genSecond ( time_f* edges, int n, time_f timef, int val )
+{
+	time_f	width;
+
+	if ( genFadeLeft > 0 )
+	{
+		genFadeLeft--;
+		return n;
+	}
+	if ( genFadeProb > 0 && genRandom () < genFadeProb )
+	{
+		genFadeLeft = genFadeSeconds - 1;
+		return n;
+	}
+
+	if ( val == 0 || genRandom () < genDropProb )
+		return n;
+
+	if ( genClockType == CLOCKTYPE_MSF && val == 11 )
+	{
+		//MSF bit b without bit a - low, high, low
+		edges[n++] = timef;
+		edges[n++] = timef + 0.1 + genStretch;
+		edges[n++] = timef + 0.2;
+		edges[n++] = timef + 0.3 + genStretch;
+	}
+	else
+	{
+		edges[n++] = timef;
+		edges[n++] = timef + val * 0.1 + genStretch;
+	}
+
+	if ( genRandom () < genGlitchProb )
+	{
+		//a spike anywhere in the second - two more toggles
+		width = 0.001 + genRandom () * 0.029;
+		timef += genRandom () * (1.0 - width);
+		edges[n++] = timef;
+		edges[n++] = timef + width;
+	}
+
+	return n;
+}
+
+static int
+genCompareTime ( const void* a, const void* b )
+{
+	time_f	ta, tb;
+
+	ta = *(const time_f*)a;
+	tb = *(const time_f*)b;
+
+	if ( ta < tb )
+		return -1;
+	else if ( ta > tb )
+		return +1;
+	return 0;
+}
+
+static int
+genMinute ( FILE* file, time_t minute, int* level )
+{
+	signed char	data[CLK_ENCODE_MAX];
+	time_f		edges[GEN_MAX_EDGES];
+	time_f		timef;
+	int		seconds, n, s, i;
+
+	switch ( genClockType )
+	{
+	case CLOCKTYPE_MSF:
+		seconds = msfEncode ( minute, genFlags ( minute ), data );
+		break;
+	case CLOCKTYPE_WWVB:
+		seconds = wwvbEncode ( minute, genFlags ( minute ), data );
+		break;
+	case CLOCKTYPE_DCF77:
+	default:
+		seconds = dcf77Encode ( minute, genFlags ( minute ), data );
+		break;
+	}
+
+	n = 0;
+	for ( s=0; s<seconds; s++ )
+	{
+		//the pc clock steps back over a leap second, as the kernel does
+		timef = minute + ( s < 60 ? s : 59 ) + genDelay;
+		n = genSecond ( edges, n, timef, data[s] );
+	}
+
+	for ( i=0; i<n; i++ )
+	{
+		if ( genJitter > 0 )
+			edges[i] += genJitter * genGaussian ();
+
+		//(from the pc clock being right at the start)
+		edges[i] += ( edges[i] - genStart ) * genDrift;
+	}
+
+	//jitter and glitches can reorder the toggles - but each one still flips the level
+	//(the leap second stays where it was, after second 59)
+	if ( seconds < 61 )
+		qsort ( edges, n, sizeof(edges[0]), genCompareTime );
+
+	for ( i=0; i<n; i++ )
+	{
+		*level = !*level;
+		if ( capWriteEdge ( file, 0, *level ? TIOCM_CD : 0, edges[i] ) < 0 )
+			return -1;
+	}
+
+	return 0;
+}
+
+
+//a time as YYYY-MM-DDTHH:MM (UTC), or seconds since 1970
+static time_t
+genParseTime ( char* str )
+{
+	struct tm	tm;
+
+	memset ( &tm, 0, sizeof(tm) );
+	if ( sscanf ( str, "%d-%d-%dT%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min ) == 5 )
+	{
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		return UTCtime ( &tm );
+	}
+
+	return (time_t)atol ( str );
+}
+
+void
+usage (void)
+{
+	printf (
+"Usage: radioclkgen [ -t dcf77|msf|wwvb ] [ -f start ] [ -n minutes ] [ -L minute ] [ -D ms ] [ -S ms ] [ -p ppm ] [ -j ms ] [ -x prob ] [ -g prob ] [ -F prob:secs ] [ -r seed ] [ -N dev ] [ -o file ]\n"
+"   -t: the radio station (default dcf77)\n"
+"   -f start: the first minute, as YYYY-MM-DDTHH:MM (UTC) or seconds since 1970 (default now)\n"
+"   -n minutes: how many minutes (default 60)\n"
+"   -L minute: this minute (YYYY-MM-DDTHH:MM UTC) ends with a leap second\n"
+"   -D ms: receiver delay\n"
+"   -p ppm: the pc clock runs this much fast (slow, if negative)\n"
+"   -S ms: the receiver stretches each pulse by this much (shortens, if negative)\n"
+"   -j ms: standard deviation of the jitter on each edge\n"
+"   -x prob: chance of each second's pulse being dropped (0-1)\n"
+"   -g prob: chance of a glitch in each second (0-1)\n"
+"   -F prob:secs: chance of the signal fading out in each second (0-1), and for how long\n"
+"   -r seed: for the random numbers\n"
+"   -N dev: the device name for radioclkd2 (default /dev/gen)\n"
+"   -o file: the capture file to write (default - for stdout)\n"
+"   summer time follows the station's own rules - pick a range over a change to test it\n"
+"   eg: radioclkgen -f 2026-03-29T00:00 -n 120 -j 2 | radioclkd2 -s replay:- gen\n"
+	);
+
+	exit(1);
+}
+
+int
+main ( int argc, char** argv )
+{
+	char*	arg;
+	char*	parm;
+	char*	filename;
+	FILE*	file;
+	time_t	minute;
+	int	level, i;
+
+	filename = "-";
+	genStart = time ( NULL );
+
+	//skip the program name
+	argc--;
+	argv++;
+
+	while ( argc > 0 )
+	{
+		arg = argv[0];
+
+		if ( arg[0] != '-' || arg[1] == 0 )
+			usage();
+
+		if ( strlen(arg) > 2 )
+		{
+			parm = arg + 2;
+		}
+		else
+		{
+			argc--;
+			argv++;
+			if ( argc == 0 )
+				usage();
+			parm = argv[0];
+		}
+
+		switch ( arg[1] )
+		{
+		case 't':
+			if ( strcasecmp ( parm, "dcf77" ) == 0 )
+				genClockType = CLOCKTYPE_DCF77;
+			else if ( strcasecmp ( parm, "msf" ) == 0 )
+				genClockType = CLOCKTYPE_MSF;
+			else if ( strcasecmp ( parm, "wwvb" ) == 0 )
+				genClockType = CLOCKTYPE_WWVB;
+			else
+				usage();
+			break;
+
+		case 'f':
+			genStart = genParseTime ( parm );
+			break;
+
+		case 'n':
+			genMinutes = atoi ( parm );
+			break;
+
+		case 'L':
+			genLeapMinute = genParseTime ( parm );
+			genLeapMinute -= genLeapMinute % 60;
+			break;
+
+		case 'D':
+			genDelay = atof ( parm ) / 1000.0;
+			break;
+
+		case 'p':
+			genDrift = atof ( parm ) / 1e6;
+			break;
+
+		case 'S':
+			genStretch = atof ( parm ) / 1000.0;
+			break;
+
+		case 'j':
+			genJitter = atof ( parm ) / 1000.0;
+			break;
+
+		case 'x':
+			genDropProb = atof ( parm );
+			break;
+
+		case 'g':
+			genGlitchProb = atof ( parm );
+			break;
+
+		case 'F':
+			genFadeProb = atof ( parm );
+			genFadeSeconds = strchr ( parm, ':' ) != NULL ? atoi ( strchr ( parm, ':' ) + 1 ) : 10;
+			if ( genFadeSeconds < 1 )
+				usage();
+			break;
+
+		case 'r':
+			genRandState = strtoull ( parm, NULL, 0 ) * 2654435769ULL + 1;
+			break;
+
+		case 'N':
+			genDevName = parm;
+			break;
+
+		case 'o':
+			filename = parm;
+			break;
+
+		default:
+			usage();
+			break;
+		}
+
+		argc--;
+		argv++;
+	}
+
+	if ( strcmp ( filename, "-" ) == 0 )
+		file = stdout;
+	else
+		file = fopen ( filename, "wb" );
+
+	if ( file == NULL )
+	{
+		fprintf ( stderr, "Error: failed to open '%s'\n", filename );
+		exit(1);
+	}
+
+	//start with the carrier on, half a second before the first minute
+	genStart -= genStart % 60;
+	level = 1;
+
+	if ( capWriteHeader ( file ) < 0 || capWriteDevice ( file, 0, genDevName ) < 0
+	  || capWriteEdge ( file, 0, TIOCM_CD, genStart - 0.5 ) < 0 )
+	{
+		fprintf ( stderr, "Error: failed to write '%s'\n", filename );
+		exit(1);
+	}
+
+	for ( i=0; i<genMinutes; i++ )
+	{
+		minute = genStart + i*60;
+
+		if ( genMinute ( file, minute, &level ) < 0 )
+		{
+			fprintf ( stderr, "Error: failed to write '%s'\n", filename );
+			exit(1);
+		}
+	}
+
+	if ( fclose ( file ) != 0 )
+		exit(1);
+
+	return 0;
+}
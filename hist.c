@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2002 Jon Atkins http://www.jonatkins.com/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hist.h"
+#include "logger.h"
+
+
+//values below 2^(HIST_SUB_BITS+1)ns get a bucket each - above that, the top HIST_SUB_BITS+1
+//bits of the value pick the bucket within its power of 2
+static int
+histBucket ( unsigned long long ns )
+{
+	int	shift;
+
+	if ( ns >= (1ULL << HIST_MAX_BITS) )
+		return HIST_BUCKETS - 1;
+
+	if ( ns < (2ULL << HIST_SUB_BITS) )
+		return (int)ns;
+
+	shift = 63 - __builtin_clzll ( ns ) - HIST_SUB_BITS;
+
+	return ( shift << HIST_SUB_BITS ) + (int)( ns >> shift );
+}
+
+//the lowest value in a bucket, and how many values it covers
+static unsigned long long
+histBucketStart ( int bucket, unsigned long long* width )
+{
+	int	shift;
+
+	if ( bucket < (2 << HIST_SUB_BITS) )
+	{
+		*width = 1;
+		return bucket;
+	}
+
+	shift = ( bucket >> HIST_SUB_BITS ) - 1;
+	*width = 1ULL << shift;
+
+	return (unsigned long long)( ( bucket & ((1 << HIST_SUB_BITS) - 1) ) + (1 << HIST_SUB_BITS) ) << shift;
+}
+
+
+void
+histClear ( histT* hist )
+{
+	memset ( hist, 0, sizeof(*hist) );
+}
+
+void
+histAdd ( histT* hist, time_f value )
+{
+	if ( value < 0 )
+	{
+		hist->negative++;
+		value = 0;
+	}
+
+	hist->counts[histBucket ( (unsigned long long)( value * 1e9 ) )]++;
+	hist->total++;
+
+	if ( value > hist->max )
+		hist->max = value;
+}
+
+void
+histMerge ( histT* dst, const histT* src )
+{
+	int	i;
+
+	for ( i=0; i<HIST_BUCKETS; i++ )
+		dst->counts[i] += src->counts[i];
+
+	dst->total += src->total;
+	dst->negative += src->negative;
+
+	if ( src->max > dst->max )
+		dst->max = src->max;
+}
+
+time_f
+histPercentile ( const histT* hist, double fraction )
+{
+	unsigned long long	start, width;
+	unsigned long		want, seen;
+	time_f			value;
+	int			i;
+
+	if ( hist->total == 0 )
+		return 0;
+
+	want = (unsigned long)( fraction * hist->total + 0.5 );
+	if ( want < 1 )
+		want = 1;
+
+	seen = 0;
+	for ( i=0; i<HIST_BUCKETS-1; i++ )
+	{
+		seen += hist->counts[i];
+		if ( seen >= want )
+			break;
+	}
+
+	//the middle of the bucket - but never more than the largest value seen
+	start = histBucketStart ( i, &width );
+	value = ( start + width / 2.0 ) / 1e9;
+
+	return ( value < hist->max ) ? value : hist->max;
+}
+
+void
+histLog ( const histT* hist, int level, const char* name )
+{
+	char	negative[32];
+
+	if ( hist->total == 0 )
+	{
+		loggerf ( level, "%s: n=0\n", name );
+		return;
+	}
+
+	negative[0] = 0;
+	if ( hist->negative > 0 )
+		snprintf ( negative, sizeof(negative), " (%lu below 0)", hist->negative );
+
+	loggerf ( level, "%s: n=%lu p50=%.1fus p90=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus%s\n", name,
+		hist->total, histPercentile ( hist, 0.5 ) * 1e6, histPercentile ( hist, 0.9 ) * 1e6,
+		histPercentile ( hist, 0.99 ) * 1e6, histPercentile ( hist, 0.999 ) * 1e6, hist->max * 1e6,
+		negative );
+}
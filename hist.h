@@ -0,0 +1,37 @@
+#ifndef HIST_H_
+#define HIST_H_
+
+#include "timef.h"
+
+
+//a log-linear (HDR style) histogram of latencies - each power of 2 of nanoseconds is split
+//into 16 buckets, so any value from 1ns to 17s is kept to within about 6%, in a fixed size
+//that adding to never allocates
+
+#define	HIST_SUB_BITS	(4)
+#define	HIST_MAX_BITS	(34)	//values from 2^34ns (17s) up all go in the last bucket
+#define	HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct
+{
+	unsigned int	counts[HIST_BUCKETS];
+	unsigned long	total;
+	unsigned long	negative;	//values below 0 - counted as 0
+	time_f		max;
+} histT;
+
+
+void histClear ( histT* hist );
+//add a value, in seconds
+void histAdd ( histT* hist, time_f value );
+//add all of src to dst
+void histMerge ( histT* dst, const histT* src );
+
+//the value fraction (0-1) of the values are at or below - 0 for an empty histogram
+time_f histPercentile ( const histT* hist, double fraction );
+
+//log a summary on one line, as "name: n=... p50=...us p90=... p99=... p99.9=... max=..."
+void histLog ( const histT* hist, int level, const char* name );
+
+
+#endif
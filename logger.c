@@ -29,6 +29,10 @@
 #include <string.h>
 #include <syslog.h>
 
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 
 
 static FILE*	logf_file;
@@ -37,6 +41,11 @@ static int	logf_file_level;
 static int	logf_syslog = 0;
 static int	logf_syslog_level;
 
+#if HAVE_PTHREAD_H
+//the serial waiter threads log too - keep their lines from being mixed up in syslogline
+static pthread_mutex_t	logf_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 void
 loggerSetFile ( FILE* file, int level )
 {
@@ -65,6 +74,10 @@ loggerf ( int level, char* format, ... )
 		vsnprintf ( buf, sizeof(buf), format, ap );
 		va_end ( ap );
 
+#if HAVE_PTHREAD_H
+		pthread_mutex_lock ( &logf_mutex );
+#endif
+
 		if ( logf_file && level <= logf_file_level )
 		{
 			fprintf ( logf_file, "%s", buf );
@@ -91,5 +104,9 @@ loggerf ( int level, char* format, ... )
 			}
 
 		}
+
+#if HAVE_PTHREAD_H
+		pthread_mutex_unlock ( &logf_mutex );
+#endif
 	}
 }
@@ -38,11 +38,21 @@
 #include <sys/mman.h>
 #endif
 
+#ifdef ENABLE_DECODETHREAD
+#include <pthread.h>
+#endif
+
 #include "settings.h"
 #include "logger.h"
 #include "clock.h"
 #include "serial.h"
 #include "memory.h"
+#include "event.h"
+#include "ring.h"
+#include "record.h"
+#include "hist.h"
+#include "discipline.h"
+#include "metrics.h"
 
 
 #if !HAVE_STRCASECMP
@@ -53,11 +63,22 @@
 # endif
 #endif
 
+//latencies on the way from an edge to the time ntpd sees, for each clock
+typedef struct
+{
+	histT	wakeup;		//the edge's timestamp, to the event loop reading it
+	histT	decode;		//the event loop reading an edge, to it being decoded
+	histT	publish;	//the timestamp of the edge that ended a minute, to the time being stored
+} clkLatencyT;
+
 typedef struct
 {
 	char*		name;
 	serLineT*	serline;
 	clkInfoT*	clock;
+
+	clkLatencyT	latency;	//since startup, up to the last hourly summary
+	clkLatencyT	hour;		//since the last hourly summary
 } serClockT;
 
 #define	MAX_CLOCKS		(16)
@@ -65,7 +86,35 @@ serClockT	clocklist[MAX_CLOCKS];
 
 
 
-void StartClocks ( serDevT* serdev );
+#ifdef ENABLE_DECODETHREAD
+//edges from the event loop to the decoding thread
+ringT*		edgering;
+#endif
+
+//the latency histograms are logged each hour, and on SIGUSR1
+#define	LATENCY_SUMMARY_INTERVAL	(60*60)
+
+static volatile sig_atomic_t	latencydump;
+static time_f			latencysummary;
+
+#ifdef ENABLE_METRICS
+//-m: a snapshot of the clocks is taken for the metrics this often, from the decoder
+#define	METRICS_INTERVAL	(1.0)
+
+static char*			metricsPath;
+static time_f			metricsnext;
+static time_f			metricsedgetime;	//the last replayed edge (0 if live)
+#endif
+
+
+int StartClocks ( serDevT* serdev );
+int StartDecoder (void);
+void ReplayDone (void);
+void UpdateClocks ( serDevT* serdev );
+void DecodeEdge ( ringEdgeT* edge );
+void LatencySignal ( int sig );
+void LatencyCheck (void);
+void MetricsCheck (void);
 
 
 
@@ -126,13 +175,20 @@ void
 usage (void)
 {
 	printf (
-"Usage: radioclkd2 [ -s poll|iwait|timepps ] [ -t dcf77|msf|wwvb ] [ -d ] [ -v ] tty[:[-]line[:fudgeoffs]] ...\n"
-"   -s poll: poll the serial port 1000 times/sec (poor)\n"
+"Usage: radioclkd2 [ -s poll|iwait|timepps|gpio|gpiochip|replay:file ] [ -t dcf77|msf|wwvb ] [ -p ppsdev ] [ -k key[:perm] ] [ -S path ] [ -G group ] [ -b usecs ] [ -g ms[:ms] ] [ -a secs ] [ -e ] [ -E unit ] [ -F unit ] [ -A ] [ -m path ] [ -c file ] [ -d ] [ -v ] tty[:[-]line[:fudgeoffs]] ...\n"
+"   -s poll: poll the serial port 1000 times/sec, or around the expected edges (poor)\n"
 "   -s iwait: wait for serial port interrupts (ok)\n"
 "   -s timepps: use the timepps interface (good)\n"
+"   -p ppsdev: take the timestamps for the next line from a pps device (eg. /dev/pps1)\n"
+"         rather than from the DCD line of the serial port itself\n"
 "   -s gpio: use /sys/class/gpio/gpioX/value for tty\n"
 "         setup \"edges\" to \"both\", uses poll() for GPIO pin interrupts\n"
 "         GPIO pulses are simulating DCD, so use :DCD and :-DCD for polarity\n"
+"   -s gpiochip: use a /dev/gpiochipN line with kernel edge timestamps (best)\n"
+"         give the line offset instead of the serial line - gpiochip0:17 or gpiochip0:-17\n"
+"   -s replay:file[:realtime]: replay a capture (- for stdin), as fast as possible or in real time\n"
+"         give the devices and lines as they were captured (gpiochip lines as #0, #1, ...)\n"
+"         runs in the foreground, without updating shared memory\n"
 #ifndef ENABLE_TIMEPPS
 "  (timepps not available)\n"
 #endif
@@ -142,15 +198,43 @@ usage (void)
 #ifndef ENABLE_GPIO
 "  (gpio not available)\n"
 #endif
+#ifndef ENABLE_GPIOCHIP
+"  (gpiochip not available)\n"
+#endif
+#ifndef ENABLE_DISCIPLINE
+"  (-A not available)\n"
+#endif
+#ifndef ENABLE_METRICS
+"  (-m not available)\n"
+#endif
 "   -t dcf77: 77.5KHz Germany/Europe DCF77 Radio Station (default)\n"
 "   -t msf: UK 60KHz MSF Radio Station\n"
 "   -t wwvb: US 60KHz WWVB Fort Collins Radio Station\n"
+"   -k key[:perm]: the shared memory key (default 0x4e545030 + the unit) and permissions\n"
+"         (octal, default 700) for the next clock - eg. -k :0640, or -k 0x4e545032:0600\n"
+"   -S path: send the next clock's times to chronyd too, as a SOCK refclock listening on path\n"
+"   -G group: the next clock hears the same station as the others in group (1 or more) - each\n"
+"         second is decoded from whichever of them received it best\n"
+"   -b usecs: kernel debounce period for gpiochip lines\n"
+"   -g minwidth[:hysteresis]: deglitch each line - levels shorter than minwidth ms are\n"
+"         dropped, and bounces within hysteresis ms of a change ignored (default 50:0, 0 for off)\n"
+"   -a secs: how many seconds of pulses are averaged for the time sent to ntpd (default 60)\n"
+"   -e: send every second to the clock's shared memory unit, not just each minute\n"
+"   -E unit: send every second to shared memory units from unit (one for each clock), as a PPS\n"
+"   -F unit: combine the clocks that agree, weighted by their errors, onto shared memory unit\n"
+"         unit too, once a minute\n"
+"   -A: discipline the kernel clock from the first clock to settle, without ntpd (a mock clock\n"
+"         when replaying)\n"
+"   -m path: serve each clock's counters (edges, bad pulses, decodes, failures...) and the\n"
+"         offset and jitter on unix socket path, in the Prometheus text format\n"
+"   -c file: capture every change on the lines to file (- for stdout), for -s replay\n"
 "   -d: debug mode. runs in the foreground and print pulses\n"
 "   -v: verbose mode.\n"
 "   tty: serial port for clock\n"
 "   line: one of dcd, cts, dsr or rng - default is dcd\n"
 "   (if - specified, treat signal as inverted\n"
 "   fudgeoffs: fudge time, in seconds\n"
+"   latency histograms for each clock are logged every hour (-v), and on SIGUSR1\n"
 		);
 
 	exit(1);
@@ -161,11 +245,19 @@ main ( int argc, char** argv )
 {
 	int	serialmode;
 	int	shmunit;
+	int	shmkey = -1;
+	int	shmperm = SHM_PERM;
+	char*	sockpath = NULL;
+	int	group = 0;
 	int	clocktype = CLOCKTYPE_DCF77;
 	char*	arg;
 	char*	parm;
-	serDevT*	devfirst;
-	serDevT*	devnext;
+	char*	ppsdev = NULL;
+	char*	replayfile = NULL;
+	char*	realtimestr;
+	int	replayrealtime = 0;
+	serDevT*	serdev;
+	int		ndevs;
 
 
 	loggerSetFile ( stderr, LOGGER_DEBUG );
@@ -174,6 +266,7 @@ main ( int argc, char** argv )
 	loggerf ( LOGGER_INFO, "version %s\n", VERSION );
 
 
+//(on Linux, the pps line discipline is attached to the port - or iwait is used if it can't be)
 #if defined(ENABLE_TIMEPPS)
 	serialmode = SERPORT_MODE_TIMEPPS;
 #elif defined(ENABLE_TIOCMIWAIT)
@@ -226,6 +319,26 @@ main ( int argc, char** argv )
 				else if ( strcasecmp ( parm, "gpio" ) == 0 )
 					serialmode = SERPORT_MODE_GPIO;
 #endif
+#ifdef ENABLE_GPIOCHIP
+				else if ( strcasecmp ( parm, "gpiochip" ) == 0 )
+					serialmode = SERPORT_MODE_GPIOCHIP;
+#endif
+				else if ( strncasecmp ( parm, "replay:", 7 ) == 0 )
+				{
+					serialmode = SERPORT_MODE_REPLAY;
+					replayfile = safe_xstrcpy ( parm + 7, -1 );
+
+					realtimestr = strrchr ( replayfile, ':' );
+					if ( realtimestr != NULL && strcasecmp ( realtimestr, ":realtime" ) == 0 )
+					{
+						*realtimestr = 0;
+						replayrealtime = 1;
+					}
+
+					//a replay must never update the shared memory the real clocks use
+					if ( !debugLevel )
+						debugLevel = 1;
+				}
 				else
 					usage();
 				break;
@@ -252,6 +365,213 @@ main ( int argc, char** argv )
                                         usage();
                                 break;
 
+			case 'p':
+				if ( strlen(arg) > 2 )
+				{
+					parm = arg + 2;
+				}
+				else
+				{
+					argc--;
+					argv++;
+					parm = argv[0];
+				}
+
+				ppsdev = parm;
+				break;
+
+			case 'k':
+				if ( strlen(arg) > 2 )
+				{
+					parm = arg + 2;
+				}
+				else
+				{
+					argc--;
+					argv++;
+					parm = argv[0];
+				}
+
+				//-k [key][:perm] - either can be left out
+				if ( *parm != ':' )
+					shmkey = strtol ( parm, NULL, 0 );
+				if ( strchr ( parm, ':' ) != NULL )
+					shmperm = strtol ( strchr ( parm, ':' ) + 1, NULL, 8 );
+
+				if ( ( *parm != ':' && shmkey < 0 ) || shmperm <= 0 || shmperm > 0777 )
+					usage();
+				break;
+
+			case 'S':
+				if ( strlen(arg) > 2 )
+				{
+					parm = arg + 2;
+				}
+				else
+				{
+					argc--;
+					argv++;
+					parm = argv[0];
+				}
+
+				sockpath = parm;
+				break;
+
+			case 'G':
+				if ( strlen(arg) > 2 )
+				{
+					parm = arg + 2;
+				}
+				else
+				{
+					argc--;
+					argv++;
+					parm = argv[0];
+				}
+
+				group = atoi ( parm );
+				if ( group <= 0 )
+					usage();
+				break;
+
+			case 'b':
+				if ( strlen(arg) > 2 )
+				{
+					parm = arg + 2;
+				}
+				else
+				{
+					argc--;
+					argv++;
+					parm = argv[0];
+				}
+
+				gpioDebounceUsec = atoi ( parm );
+				break;
+
+			case 'g':
+				if ( strlen(arg) > 2 )
+				{
+					parm = arg + 2;
+				}
+				else
+				{
+					argc--;
+					argv++;
+					parm = argv[0];
+				}
+
+				glitchWidth = atof ( parm ) / 1000.0;
+				glitchHysteresis = 0;
+				if ( strchr ( parm, ':' ) != NULL )
+					glitchHysteresis = atof ( strchr ( parm, ':' ) + 1 ) / 1000.0;
+
+				//(bounces can only be ignored while a change is pending)
+				if ( glitchWidth < 0 || glitchHysteresis < 0 || ( glitchWidth > 0 && glitchHysteresis >= glitchWidth ) )
+					usage();
+				break;
+
+			case 'a':
+				if ( strlen(arg) > 2 )
+				{
+					parm = arg + 2;
+				}
+				else
+				{
+					argc--;
+					argv++;
+					parm = argv[0];
+				}
+
+				ppsWindow = atoi ( parm );
+				if ( ppsWindow < 4 )
+					usage();
+				break;
+
+			case 'e':
+				shmEverySecond = 1;
+				break;
+
+			case 'F':
+				if ( strlen(arg) > 2 )
+				{
+					parm = arg + 2;
+				}
+				else
+				{
+					argc--;
+					argv++;
+					parm = argv[0];
+				}
+
+				shmFuseUnit = atoi ( parm );
+				if ( shmFuseUnit < 0 )
+					usage();
+				break;
+
+			case 'm':
+				if ( strlen(arg) > 2 )
+				{
+					parm = arg + 2;
+				}
+				else
+				{
+					argc--;
+					argv++;
+					parm = argv[0];
+				}
+
+#ifdef ENABLE_METRICS
+				metricsPath = parm;
+#else
+				usage();
+#endif
+				break;
+
+			case 'A':
+#ifdef ENABLE_DISCIPLINE
+				clockDiscipline = 1;
+#else
+				usage();
+#endif
+				break;
+
+			case 'E':
+				if ( strlen(arg) > 2 )
+				{
+					parm = arg + 2;
+				}
+				else
+				{
+					argc--;
+					argv++;
+					parm = argv[0];
+				}
+
+				shmPpsUnit = atoi ( parm );
+				if ( shmPpsUnit < 0 )
+					usage();
+				break;
+
+			case 'c':
+				if ( strlen(arg) > 2 )
+				{
+					parm = arg + 2;
+				}
+				else
+				{
+					argc--;
+					argv++;
+					parm = argv[0];
+				}
+
+				if ( recOpenCapture ( parm ) < 0 )
+				{
+					loggerf ( LOGGER_NOTE, "Error: failed to open capture file '%s'\n", parm );
+					exit(1);
+				}
+				break;
+
                         case 'd':
 				debugLevel ++;
 				break;
@@ -307,7 +627,23 @@ main ( int argc, char** argv )
 					linestr++;
 				}
 
-				if ( strcasecmp ( linestr, "cd" ) == 0 || strcasecmp ( linestr, "dcd" ) == 0 )
+				if ( serialmode == SERPORT_MODE_GPIOCHIP )
+				{
+					//gpio chip lines are given by their line offset
+					if ( *linestr >= '0' && *linestr <= '9' )
+						line = atoi ( linestr );
+					else
+					{
+						line = -1;
+						loggerf ( LOGGER_NOTE, "Error: bad gpio line offset '%s'\n", linestr );
+					}
+				}
+				else if ( serialmode == SERPORT_MODE_REPLAY && *linestr == '#' )
+				{
+					//a raw line bit - for gpiochip captures
+					line = 1 << atoi ( linestr+1 );
+				}
+				else if ( strcasecmp ( linestr, "cd" ) == 0 || strcasecmp ( linestr, "dcd" ) == 0 )
 					line = TIOCM_CD;
 				else if ( strcasecmp ( linestr, "cts" ) == 0 )
 					line = TIOCM_CTS;
@@ -322,6 +658,11 @@ main ( int argc, char** argv )
 				}
 
 			}
+			else if ( serialmode == SERPORT_MODE_GPIOCHIP )
+			{
+				line = -1;
+				loggerf ( LOGGER_NOTE, "Error: no gpio line offset given for '%s'\n", arg );
+			}
 	
 
 			//right - we've got the serial port details - store them...
@@ -330,7 +671,25 @@ main ( int argc, char** argv )
 			if ( serline == NULL )
 				loggerf ( LOGGER_NOTE, "Error: failed to attach to serial line '%s'\n", arg );
 
-			clock = clkCreate ( negate, shmunit, fudgeoffset, clocktype );
+			//-p only applies to the line that follows it
+			if ( serline != NULL && ppsdev != NULL )
+			{
+				if ( serSetLinePps ( serline, ppsdev ) < 0 )
+				{
+					loggerf ( LOGGER_NOTE, "Error: failed to use pps device '%s' for serial line '%s'\n", ppsdev, arg );
+					serline = NULL;
+				}
+			}
+			ppsdev = NULL;
+
+			//so do -k, -S and -G
+			clock = clkCreate ( negate, shmunit, shmkey, shmperm, sockpath, fudgeoffset, clocktype );
+			shmkey = -1;
+			shmperm = SHM_PERM;
+			sockpath = NULL;
+			if ( clock != NULL )
+				clock->group = group;
+			group = 0;
 			if ( clock == NULL )
 				loggerf ( LOGGER_NOTE, "Error: failed to create clock for serial line '%s'\n", arg );
 
@@ -386,50 +745,64 @@ main ( int argc, char** argv )
 		loggerSyslog ( 0, 0 );
 	}
 
-//right - we're ready to start...
-//now, due to the fact that we can only watch one serial port at a time, we'll have
-//to fork off for all but the first serial port
+#ifdef ENABLE_DISCIPLINE
+	//(a replay, or -d, must never touch the real clock - and only the replayed edges are read
+	//through the mock clock, so -d on its own can't close the loop)
+	if ( clockDiscipline && debugLevel && serialmode != SERPORT_MODE_REPLAY )
+	{
+		loggerf ( LOGGER_NOTE, "Error: -A with -d is only possible for a replay\n" );
+		exit(1);
+	}
+	if ( clockDiscipline )
+		discInit ( debugLevel ? &discMock : &discKernel );
+#endif
 
-	devfirst = serGetDev ( NULL );
+#ifdef ENABLE_METRICS
+	//(after the fork - the thread wouldn't survive it)
+	if ( metricsPath != NULL && metStart ( metricsPath ) < 0 )
+		loggerf ( LOGGER_NOTE, "Error: failed to serve metrics on '%s'\n", metricsPath );
+#endif
 
-	devnext = devfirst;
+//right - we're ready to start...
+//all the serial ports are watched from a single event loop
 
-	//we don't want to do this if we're debugging clocks...
-	if ( !debugLevel )
+	if ( evtInit () < 0 )
 	{
+		loggerf ( LOGGER_NOTE, "Error: failed to initialise the event loop\n" );
+		exit(1);
+	}
 
-		while ( (devnext = serGetDev(devnext)) != NULL )
-		{
-			int	pid;
+	//(a replay as fast as possible decodes in the event loop, so that nothing is dropped)
+	if ( (serialmode != SERPORT_MODE_REPLAY || replayrealtime) && StartDecoder () < 0 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: failed to start the decoder\n" );
+		exit(1);
+	}
 
-			pid = fork();
+	signal ( SIGUSR1, LatencySignal );
 
-			if ( pid < 0 )
-			{
-				loggerf ( LOGGER_INFO, "fork() failed for other devices\n" );
-				//as we have forked above, this will kill all processes in the current process group (ie, just us)
-				kill ( 0, SIGTERM );
-			}
-			else if ( pid == 0 )
-			{
-				//child
-				StartClocks ( devnext );
+	ndevs = 0;
+	for ( serdev = serGetDev ( NULL ); serdev != NULL; serdev = serGetDev ( serdev ) )
+	{
+		if ( StartClocks ( serdev ) == 0 )
+			ndevs++;
+	}
 
-				loggerf ( LOGGER_INFO, "child process terminated\n" );
-				exit(0);
-			}
-			//else parent - continue on
-		}
+	if ( ndevs == 0 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: no serial devices could be started\n" );
+		exit(1);
 	}
-	else
+
+	if ( serialmode == SERPORT_MODE_REPLAY && recStartReplay ( replayfile, replayrealtime, ReplayDone ) < 0 )
 	{
-		if ( serGetDev(devnext) != NULL )
-			loggerf ( LOGGER_INFO, "Additional serial lines ignored in debug mode\n" );
+		loggerf ( LOGGER_NOTE, "Error: failed to replay '%s'\n", replayfile );
+		exit(1);
 	}
 
-	StartClocks ( devfirst );
+	evtRun ();
 
-	loggerf ( LOGGER_INFO, "parent process terminated\n" );
+	loggerf ( LOGGER_INFO, "event loop terminated\n" );
 	exit(1);
 
 
@@ -437,45 +810,330 @@ main ( int argc, char** argv )
 }
 
 
+//add an edge that a clock has decoded to its latency histograms
+static void
+LatencyAdd ( serClockT* serclock, ringEdgeT* edge, int published )
+{
+	struct timeval	tv;
+	time_f		now;
+
+	gettimeofday ( &tv, NULL );
+	timeval2time_f ( &tv, now );
+
+	histAdd ( &serclock->hour.wakeup, edge->seen - edge->timef );
+	histAdd ( &serclock->hour.decode, now - edge->seen );
+	if ( published )
+		histAdd ( &serclock->hour.publish, now - edge->timef );
+}
+
+static void
+LatencyLog ( clkLatencyT* latency, int level, const char* name, const char* period )
+{
+	char	buf[256];
+
+	snprintf ( buf, sizeof(buf), "%s: %s wakeup", name, period );
+	histLog ( &latency->wakeup, level, buf );
+	snprintf ( buf, sizeof(buf), "%s: %s decode", name, period );
+	histLog ( &latency->decode, level, buf );
+	snprintf ( buf, sizeof(buf), "%s: %s publish", name, period );
+	histLog ( &latency->publish, level, buf );
+}
+
+//SIGUSR1 - log the latencies so far, from the decoder
 void
-StartClocks ( serDevT* serdev )
+LatencySignal ( int sig )
 {
-	serLineT*	serline;
+	latencydump = 1;
+
+#ifdef ENABLE_DECODETHREAD
+	if ( edgering != NULL )
+		ringSignal ( edgering );
+#endif
+}
+
+//called wherever the edges are decoded, after each batch - the histograms are only
+//touched from there
+void
+LatencyCheck (void)
+{
+	clkLatencyT	total;
+	time_f		now;
+	int		hourly;
 	int		c;
 
+	now = evtNow ();
+	if ( latencysummary == 0 )
+		latencysummary = now + LATENCY_SUMMARY_INTERVAL;
 
-	loggerf ( LOGGER_INFO, "pid %d for device %s\n", getpid(), serdev->dev );
+	hourly = ( now >= latencysummary );
+	if ( !hourly && !latencydump )
+		return;
 
-	if ( serInitHardware ( serdev ) < 0 )
+	for ( c = 0; c<MAX_CLOCKS; c++ )
 	{
-		loggerf ( LOGGER_INFO, "error initialising serial device\n" );
-		return;
+		if ( clocklist[c].clock == NULL )
+			continue;
+
+		if ( latencydump )
+		{
+			total = clocklist[c].latency;
+			histMerge ( &total.wakeup, &clocklist[c].hour.wakeup );
+			histMerge ( &total.decode, &clocklist[c].hour.decode );
+			histMerge ( &total.publish, &clocklist[c].hour.publish );
+
+			LatencyLog ( &total, LOGGER_NOTE, clocklist[c].name, "since startup" );
+			loggerf ( LOGGER_NOTE, "%s: deglitching dropped %lu spikes, ignored %lu bounces\n", clocklist[c].name,
+				clocklist[c].serline->glitchspikes, clocklist[c].serline->glitchbounces );
+			loggerf ( LOGGER_NOTE, "%s: %lu seconds checked against the expected minute, %lu disagreed\n", clocklist[c].name,
+				clocklist[c].clock->lockseconds, clocklist[c].clock->lockerrors );
+			if ( clocklist[c].clock->group )
+				loggerf ( LOGGER_NOTE, "%s: %lu seconds taken from the others in group %d\n", clocklist[c].name,
+					clocklist[c].clock->divfilled, clocklist[c].clock->group );
+			if ( shmFuseUnit >= 0 )
+				loggerf ( LOGGER_NOTE, "%s: combined in %lu minutes, left out of %lu for disagreeing\n", clocklist[c].name,
+					clocklist[c].clock->fuseused, clocklist[c].clock->fuserejects );
+		}
+
+		if ( hourly )
+		{
+			LatencyLog ( &clocklist[c].hour, LOGGER_INFO, clocklist[c].name, "last hour" );
+
+			histMerge ( &clocklist[c].latency.wakeup, &clocklist[c].hour.wakeup );
+			histMerge ( &clocklist[c].latency.decode, &clocklist[c].hour.decode );
+			histMerge ( &clocklist[c].latency.publish, &clocklist[c].hour.publish );
+			histClear ( &clocklist[c].hour.wakeup );
+			histClear ( &clocklist[c].hour.decode );
+			histClear ( &clocklist[c].hour.publish );
+		}
 	}
 
-	while(1)
+	latencydump = 0;
+	if ( hourly )
+		latencysummary += LATENCY_SUMMARY_INTERVAL;
+}
+
+//take a snapshot of the clocks for -m, each METRICS_INTERVAL - from wherever the edges are
+//decoded, after each batch
+void
+MetricsCheck (void)
+{
+#ifdef ENABLE_METRICS
+	static const char* stations[] = { "dcf77", "msf", "wwvb" };
+	metClockT	clocks[MAX_CLOCKS];
+	clkInfoT*	clock;
+	struct timeval	tv;
+	time_f		now, wallnow, err;
+	int		n, c;
+
+	if ( metricsPath == NULL )
+		return;
+
+	now = evtNow ();
+	if ( now < metricsnext )
+		return;
+	metricsnext = now + METRICS_INTERVAL;
+
+	n = 0;
+	for ( c = 0; c<MAX_CLOCKS; c++ )
 	{
-		if ( serWaitForSerialChange ( serdev ) < 0 )
-		{
-			loggerf ( LOGGER_DEBUG, "no serial line change\n" );
+		clock = clocklist[c].clock;
+		if ( clock == NULL )
 			continue;
-		}
 
-		serUpdateLinesForDevice ( serdev );
+		memset ( &clocks[n], 0, sizeof(metClockT) );
+		clocks[n].name = clocklist[c].name;
+		clocks[n].station = clock->clocktype >= 0 && clock->clocktype < 3 ? stations[clock->clocktype] : "unknown";
+		clocks[n].edges = clock->edges;
+		clocks[n].missededges = clock->missededges;
+		clocks[n].glitchspikes = clocklist[c].serline->glitchspikes;
+		clocks[n].glitchbounces = clocklist[c].serline->glitchbounces;
+		clocks[n].badshort = clock->badshort;
+		clocks[n].badlong = clock->badlong;
+		clocks[n].decodesfull = clock->decodesfull;
+		clocks[n].decodespartial = clock->decodespartial;
+		clocks[n].failshort = clock->failshort;
+		clocks[n].failinvalid = clock->failinvalid;
+		clocks[n].lockseconds = clock->lockseconds;
+		clocks[n].lockerrors = clock->lockerrors;
+		clocks[n].filtered = clkPredictPPS ( clock, clock->filtertime, &clocks[n].offset, &err ) >= 0;
+		clocks[n].jitter = clock->filternoise;
+		clocks[n].frequency = clock->filterfreq * 1e6;
+		clocks[n].firstedge = clock->firstedge;
+		clocks[n].firstdecode = clock->firstdecode;
+		clocks[n].lastdecode = clock->lastdecode;
+		n++;
+	}
 
-		serline = NULL;
-		while ( (serline = serGetLine(serline)) != NULL )
+	//(the clocks' times are wall clock times, like the edges' - now is only for the interval)
+	gettimeofday ( &tv, NULL );
+	timeval2time_f ( &tv, wallnow );
+	metUpdate ( clocks, n, edgering != NULL ? ringOverflows ( edgering ) : 0, metricsedgetime != 0 ? metricsedgetime : wallnow );
+#endif
+}
+
+//pass an edge on to all the clocks on its line
+void
+DecodeEdge ( ringEdgeT* edge )
+{
+	clkInfoT*	clock;
+	time_f		changetime, radiotime;
+	int		c;
+
+	for ( c = 0; c<MAX_CLOCKS; c++ )
+	{
+		if ( clocklist[c].serline == edge->line )
 		{
-			for ( c = 0; c<MAX_CLOCKS; c++ )
-			{
-				if ( (serline->dev == serdev)
-				  && (clocklist[c].serline == serline) )
-				{
-					clkProcessStatusChange ( clocklist[c].clock, serline->curstate, serline->eventtime );
+			clock = clocklist[c].clock;
 
-				}
+			if ( edge->missed > 0 )
+			{
+				clkProcessErasure ( clock, edge->state, edge->missed, edge->timef );
+				continue;
 			}
+
+			changetime = clock->changetime;
+			radiotime = clock->radiotime;
+#ifdef ENABLE_METRICS
+			if ( edge->seen == 0 )
+				metricsedgetime = edge->timef;
+#endif
+
+			clkProcessStatusChange ( clock, edge->state, edge->timef );
+
+			//(all the lines on a device are passed on together - only time real changes)
+			if ( edge->seen != 0 && clock->changetime != changetime )
+				LatencyAdd ( &clocklist[c], edge, clock->radiotime != radiotime );
+		}
+	}
+}
+
+//pass the new line states on to all the clocks on this device
+void
+UpdateClocks ( serDevT* serdev )
+{
+	serLineT*	serline;
+	ringEdgeT	edge;
+
+	serUpdateLinesForDevice ( serdev );
+
+	serline = NULL;
+	while ( (serline = serGetLine(serline)) != NULL )
+	{
+		if ( serline->dev != serdev )
+			continue;
+
+		edge.line = serline;
+		edge.state = serline->curstate;
+		edge.missed = serline->missed;
+		edge.timef = ( serline->missed > 0 ) ? serline->missedtime : serline->eventtime;
+		//(when the edge was read, not when deglitching passed it on)
+		edge.seen = serline->seentime;
+		serline->missed = 0;
+
+#ifdef ENABLE_DECODETHREAD
+		if ( edgering != NULL )
+			ringPush ( edgering, &edge );
+		else
+#endif
+			DecodeEdge ( &edge );
+	}
+
+#ifdef ENABLE_DECODETHREAD
+	if ( edgering != NULL )
+		ringSignal ( edgering );
+	else
+#endif
+	{
+		LatencyCheck ();
+		MetricsCheck ();
+	}
+}
+
+//the whole capture has been replayed
+void
+ReplayDone (void)
+{
+#ifdef ENABLE_DECODETHREAD
+	//(in real time, carry on as if the receiver had been unplugged)
+	if ( edgering != NULL )
+		return;
+#endif
+
+	exit(0);
+}
+
+#ifdef ENABLE_DECODETHREAD
+//decoding (and logging, and publishing the time) happens here, away from the event loop
+void*
+DecodeThread ( void* arg )
+{
+	ringEdgeT	edge;
+	unsigned int	overflows, lastoverflows;
+#ifdef ENABLE_SCHED
+	struct sched_param schedp;
+
+	//the event loop keeps the realtime priority - decoding can wait
+	memset ( &schedp, 0, sizeof(schedp) );
+	pthread_setschedparam ( pthread_self(), SCHED_OTHER, &schedp );
+#endif
+
+	lastoverflows = 0;
+
+	while ( 1 )
+	{
+		ringWait ( edgering );
+
+		while ( ringPop ( edgering, &edge ) )
+			DecodeEdge ( &edge );
+
+		LatencyCheck ();
+		MetricsCheck ();
+
+		overflows = ringOverflows ( edgering );
+		if ( overflows != lastoverflows )
+		{
+			loggerf ( LOGGER_NOTE, "Error: %u edges lost - the decoder isn't keeping up\n", overflows - lastoverflows );
+			lastoverflows = overflows;
 		}
+	}
+
+	return NULL;
+}
+#endif
 
+int
+StartDecoder (void)
+{
+#ifdef ENABLE_DECODETHREAD
+	pthread_t	thread;
+
+	edgering = ringCreate ();
+	if ( edgering == NULL )
+		return -1;
+
+	if ( pthread_create ( &thread, NULL, DecodeThread, NULL ) != 0 )
+		return -1;
+#endif
+
+	return 0;
+}
+
+int
+StartClocks ( serDevT* serdev )
+{
+	loggerf ( LOGGER_INFO, "starting device %s\n", serdev->dev );
+
+	if ( serInitHardware ( serdev ) < 0 )
+	{
+		loggerf ( LOGGER_INFO, "error initialising serial device %s\n", serdev->dev );
+		return -1;
+	}
+
+	if ( serStartDev ( serdev, UpdateClocks ) < 0 )
+	{
+		loggerf ( LOGGER_INFO, "error starting serial device %s\n", serdev->dev );
+		return -1;
 	}
 
+	return 0;
 }
@@ -31,6 +31,10 @@
 #include "logger.h"
 
 
+//how many allocations have been made - for radioclkbench
+static unsigned long	memAllocCount;
+
+
 void*
 safe_mallocz ( size_t size )
 {
@@ -43,6 +47,7 @@ safe_mallocz ( size_t size )
 		exit(1);
 	}
 	memset ( ptr, 0, size );
+	memAllocCount++;
 	return ptr;
 }
 
@@ -71,6 +76,13 @@ safe_xstrcpy ( char* str, int len )
 
 	memcpy ( ret, str, len );
 	ret[len] = 0;
+	memAllocCount++;
 
 	return ret;
 }
+
+unsigned long
+safe_alloccount (void)
+{
+	return memAllocCount;
+}
@@ -12,4 +12,7 @@ void safe_free ( void* ptr );
 //will always nul-terminate the result
 char* safe_xstrcpy ( char* str, int len );
 
+//the number of safe_mallocz() and safe_xstrcpy() calls so far
+unsigned long safe_alloccount (void);
+
 #endif
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2002 Jon Atkins http://www.jonatkins.com/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#ifdef ENABLE_METRICS
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+
+#ifdef ENABLE_SCHED
+#include <sched.h>
+#endif
+
+#include "metrics.h"
+#include "systime.h"
+#include "timef.h"
+#include "logger.h"
+#include "memory.h"
+
+//the edge rates are over at least this long
+#define	MET_RATE_INTERVAL	(10.0)
+//how long a connection has to send a request, and to take the reply
+#define	MET_REQUEST_WAIT	(100)		//ms
+#define	MET_SEND_TIMEOUT	(1)		//s
+#define	MET_BUFFER		(MET_MAX_CLOCKS*4096)
+
+//the last snapshot - only held while it's copied in or out
+static pthread_mutex_t	metLock = PTHREAD_MUTEX_INITIALIZER;
+static metClockT	metClocks[MET_MAX_CLOCKS];
+static time_f		metRates[MET_MAX_CLOCKS];
+static int		metNumClocks;
+static unsigned long	metOverflows;
+static time_f		metTime;	//the snapshot's time, on the clocks' pc times...
+static time_f		metWall;	//...and on this one's
+
+//the decoder's own, for the edge rates
+static unsigned long	metRateEdges[MET_MAX_CLOCKS];
+static time_f		metRateTime;
+static time_f		metRateNow[MET_MAX_CLOCKS];
+
+static int		metFd = -1;
+
+
+//the counters, each line's value at its offset in metClockT (those with the same name share
+//the HELP and TYPE)
+static const struct
+{
+	const char*	name;
+	const char*	label;
+	size_t		field;
+	const char*	help;
+} metCounters[] = {
+	{ "radioclkd2_edges_total", NULL, offsetof(metClockT,edges), "Changes on the receiver's line" },
+	{ "radioclkd2_missed_edges_total", NULL, offsetof(metClockT,missededges), "Edges that toggled between two reads, and were lost" },
+	{ "radioclkd2_glitch_spikes_total", NULL, offsetof(metClockT,glitchspikes), "Spikes dropped by the deglitching" },
+	{ "radioclkd2_glitch_bounces_total", NULL, offsetof(metClockT,glitchbounces), "Bounces ignored just after a change" },
+	{ "radioclkd2_bad_pulses_total", "length=\"short\"", offsetof(metClockT,badshort), "Pulses of no length the station sends" },
+	{ "radioclkd2_bad_pulses_total", "length=\"long\"", offsetof(metClockT,badlong), NULL },
+	{ "radioclkd2_decodes_total", "data=\"full\"", offsetof(metClockT,decodesfull), "Minutes decoded, from all their seconds or with some lost" },
+	{ "radioclkd2_decodes_total", "data=\"partial\"", offsetof(metClockT,decodespartial), NULL },
+	{ "radioclkd2_decode_failures_total", "reason=\"short_data\"", offsetof(metClockT,failshort), "Minutes that failed to decode, with seconds lost or with all of them" },
+	{ "radioclkd2_decode_failures_total", "reason=\"invalid_data\"", offsetof(metClockT,failinvalid), NULL },
+	{ "radioclkd2_lock_seconds_total", NULL, offsetof(metClockT,lockseconds), "Seconds checked against the minute expected" },
+	{ "radioclkd2_lock_errors_total", NULL, offsetof(metClockT,lockerrors), "Seconds that disagreed with the minute expected" },
+};
+
+
+void
+metUpdate ( const metClockT* clocks, int n, unsigned long overflows, time_f now )
+{
+	struct timeval	tv;
+	int	i;
+
+	if ( n > MET_MAX_CLOCKS )
+		n = MET_MAX_CLOCKS;
+
+	if ( metRateTime == 0 )
+		metRateTime = now;
+	if ( now - metRateTime >= MET_RATE_INTERVAL )
+	{
+		for ( i=0; i<n; i++ )
+		{
+			metRateNow[i] = ( clocks[i].edges - metRateEdges[i] ) / ( now - metRateTime );
+			metRateEdges[i] = clocks[i].edges;
+		}
+		metRateTime = now;
+	}
+
+	if ( pthread_mutex_trylock ( &metLock ) != 0 )
+		return;
+
+	memcpy ( metClocks, clocks, n * sizeof(metClockT) );
+	memcpy ( metRates, metRateNow, n * sizeof(time_f) );
+	metNumClocks = n;
+	metOverflows = overflows;
+	metTime = now;
+	gettimeofday ( &tv, NULL );
+	timeval2time_f ( &tv, metWall );
+
+	pthread_mutex_unlock ( &metLock );
+}
+
+
+static void
+metPrintf ( char* buf, int* plen, const char* format, ... )
+{
+	va_list	ap;
+	int	len;
+
+	if ( *plen >= MET_BUFFER )
+		return;
+
+	va_start ( ap, format );
+	len = vsnprintf ( buf + *plen, MET_BUFFER - *plen, format, ap );
+	va_end ( ap );
+
+	*plen += len > 0 ? len : 0;
+	if ( *plen > MET_BUFFER )
+		*plen = MET_BUFFER;
+}
+
+static void
+metGauge ( char* buf, int* plen, const char* name, const char* help )
+{
+	metPrintf ( buf, plen, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name );
+}
+
+//the text for a snapshot
+static int
+metFormat ( char* buf, const metClockT* clocks, const time_f* rates, int n, unsigned long overflows, time_f now )
+{
+	const metClockT* clock;
+	int	len, i, c;
+
+	len = 0;
+
+	metPrintf ( buf, &len, "# HELP radioclkd2_ring_overflows_total Edges lost because the decoder wasn't keeping up\n"
+		"# TYPE radioclkd2_ring_overflows_total counter\nradioclkd2_ring_overflows_total %lu\n", overflows );
+
+	for ( i=0; i<sizeof(metCounters)/sizeof(metCounters[0]); i++ )
+	{
+		if ( metCounters[i].help != NULL )
+			metPrintf ( buf, &len, "# HELP %s %s\n# TYPE %s counter\n", metCounters[i].name, metCounters[i].help, metCounters[i].name );
+
+		for ( c=0; c<n; c++ )
+		{
+			metPrintf ( buf, &len, "%s{clock=\"%s\",station=\"%s\"%s%s} %lu\n", metCounters[i].name, clocks[c].name, clocks[c].station,
+				metCounters[i].label != NULL ? "," : "", metCounters[i].label != NULL ? metCounters[i].label : "",
+				*(const unsigned long*)( (const char*)&clocks[c] + metCounters[i].field ) );
+		}
+	}
+
+	metGauge ( buf, &len, "radioclkd2_edges_per_second", "Changes on the receiver's line, over the last 10s" );
+	for ( c=0; c<n; c++ )
+		metPrintf ( buf, &len, "radioclkd2_edges_per_second{clock=\"%s\",station=\"%s\"} %.3f\n", clocks[c].name, clocks[c].station, rates[c] );
+
+	//(the rest are left out until they're known)
+	metGauge ( buf, &len, "radioclkd2_offset_seconds", "The pc clock less the radio time, from the filter" );
+	for ( c=0; c<n; c++ )
+	{
+		if ( clocks[c].filtered )
+			metPrintf ( buf, &len, "radioclkd2_offset_seconds{clock=\"%s\",station=\"%s\"} %.9f\n", clocks[c].name, clocks[c].station, clocks[c].offset );
+	}
+	metGauge ( buf, &len, "radioclkd2_jitter_seconds", "The standard deviation of each second's offset" );
+	for ( c=0; c<n; c++ )
+	{
+		if ( clocks[c].filtered )
+			metPrintf ( buf, &len, "radioclkd2_jitter_seconds{clock=\"%s\",station=\"%s\"} %.9f\n", clocks[c].name, clocks[c].station, clocks[c].jitter );
+	}
+	metGauge ( buf, &len, "radioclkd2_frequency_ppm", "How fast the pc clock runs against the radio time" );
+	for ( c=0; c<n; c++ )
+	{
+		if ( clocks[c].filtered )
+			metPrintf ( buf, &len, "radioclkd2_frequency_ppm{clock=\"%s\",station=\"%s\"} %.3f\n", clocks[c].name, clocks[c].station, clocks[c].frequency );
+	}
+	metGauge ( buf, &len, "radioclkd2_seconds_since_decode", "Since the start of the last minute decoded" );
+	for ( c=0; c<n; c++ )
+	{
+		clock = &clocks[c];
+		if ( clock->lastdecode != 0 )
+			metPrintf ( buf, &len, "radioclkd2_seconds_since_decode{clock=\"%s\",station=\"%s\"} %.3f\n", clock->name, clock->station, now - clock->lastdecode );
+	}
+	metGauge ( buf, &len, "radioclkd2_time_to_first_fix_seconds", "From the first edge to the start of the first minute decoded" );
+	for ( c=0; c<n; c++ )
+	{
+		clock = &clocks[c];
+		if ( clock->firstdecode != 0 )
+			metPrintf ( buf, &len, "radioclkd2_time_to_first_fix_seconds{clock=\"%s\",station=\"%s\"} %.3f\n", clock->name, clock->station, clock->firstdecode - clock->firstedge );
+	}
+
+	return len;
+}
+
+//reply to a connection - with the request (if any) read first, so the close is clean
+static void
+metServe ( int fd, char* buf, metClockT* clocks, time_f* rates )
+{
+	struct pollfd	pfd;
+	struct timeval	tv;
+	char		request[1024];
+	const char*	header;
+	unsigned long	overflows;
+	time_f		now, wall, wallnow;
+	int		n, len, got, sent, ret;
+
+	tv.tv_sec = MET_SEND_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt ( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv) );
+
+	got = 0;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if ( poll ( &pfd, 1, MET_REQUEST_WAIT ) > 0 )
+	{
+		got = recv ( fd, request, sizeof(request)-1, MSG_DONTWAIT );
+		got = got > 0 ? got : 0;
+	}
+	request[got] = 0;
+
+	pthread_mutex_lock ( &metLock );
+	n = metNumClocks;
+	memcpy ( clocks, metClocks, n * sizeof(metClockT) );
+	memcpy ( rates, metRates, n * sizeof(time_f) );
+	overflows = metOverflows;
+	now = metTime;
+	wall = metWall;
+	pthread_mutex_unlock ( &metLock );
+
+	//the time since the last decode is up to now, not the snapshot - a receiver that has
+	//stopped has no edges to take snapshots on
+	gettimeofday ( &tv, NULL );
+	timeval2time_f ( &tv, wallnow );
+	if ( wall != 0 )
+		now += wallnow - wall;
+
+	len = metFormat ( buf, clocks, rates, n, overflows, now );
+
+	header = "";
+	if ( strncmp ( request, "GET ", 4 ) == 0 )
+		header = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n";
+	if ( *header != 0 && send ( fd, header, strlen ( header ), MSG_NOSIGNAL ) < 0 )
+		return;
+
+	for ( sent = 0; sent < len; sent += ret )
+	{
+		ret = send ( fd, buf + sent, len - sent, MSG_NOSIGNAL );
+		if ( ret <= 0 )
+			return;
+	}
+}
+
+static void*
+metThread ( void* arg )
+{
+	metClockT*	clocks;
+	time_f*		rates;
+	char*		buf;
+	int		fd;
+#ifdef ENABLE_SCHED
+	struct sched_param schedp;
+
+	//the event loop keeps the realtime priority - a scraper mustn't compete with it
+	memset ( &schedp, 0, sizeof(schedp) );
+	pthread_setschedparam ( pthread_self(), SCHED_OTHER, &schedp );
+#endif
+
+	buf = safe_mallocz ( MET_BUFFER );
+	clocks = safe_mallocz ( MET_MAX_CLOCKS * sizeof(metClockT) );
+	rates = safe_mallocz ( MET_MAX_CLOCKS * sizeof(time_f) );
+
+	while ( 1 )
+	{
+		fd = accept ( metFd, NULL, NULL );
+		if ( fd < 0 )
+			continue;
+
+		metServe ( fd, buf, clocks, rates );
+		close ( fd );
+	}
+
+	return NULL;
+}
+
+int
+metStart ( const char* path )
+{
+	struct sockaddr_un	addr;
+	pthread_t		thread;
+
+	if ( strlen ( path ) >= sizeof(addr.sun_path) )
+		return -1;
+
+	metFd = socket ( AF_UNIX, SOCK_STREAM, 0 );
+	if ( metFd < 0 )
+		return -1;
+	fcntl ( metFd, F_SETFD, FD_CLOEXEC );
+
+	//(one left behind by the last run is in the way)
+	unlink ( path );
+
+	memset ( &addr, 0, sizeof(addr) );
+	addr.sun_family = AF_UNIX;
+	strcpy ( addr.sun_path, path );
+	if ( bind ( metFd, (struct sockaddr*)&addr, sizeof(addr) ) < 0 || listen ( metFd, 4 ) < 0 )
+	{
+		close ( metFd );
+		metFd = -1;
+		return -1;
+	}
+
+	if ( pthread_create ( &thread, NULL, metThread, NULL ) != 0 )
+		return -1;
+	pthread_detach ( thread );
+
+	return 0;
+}
+
+#endif
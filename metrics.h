@@ -0,0 +1,50 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include "config.h"
+
+#ifdef ENABLE_METRICS
+
+#include "timef.h"
+
+
+//-m: each clock's counters and gauges, served in the Prometheus text format to each
+//connection on a unix socket (with an HTTP header, if it was asked for with GET)
+#define	MET_MAX_CLOCKS	(16)
+
+typedef struct
+{
+	const char*	name;		//the clock's line
+	const char*	station;
+	unsigned long	edges;
+	unsigned long	missededges;
+	unsigned long	glitchspikes;
+	unsigned long	glitchbounces;
+	unsigned long	badshort;
+	unsigned long	badlong;
+	unsigned long	decodesfull;
+	unsigned long	decodespartial;
+	unsigned long	failshort;
+	unsigned long	failinvalid;
+	unsigned long	lockseconds;
+	unsigned long	lockerrors;
+	int		filtered;	//set once the filter has settled, for the offset...
+	time_f		offset;		//...pc less radio time (seconds)
+	time_f		jitter;		//...the standard deviation of a second (seconds)
+	time_f		frequency;	//...and how fast the pc clock runs (ppm)
+	time_f		firstedge;	//pc times, or 0
+	time_f		firstdecode;
+	time_f		lastdecode;
+} metClockT;
+
+
+//listen on path, in a thread of its own
+int metStart ( const char* path );
+
+//a snapshot of the clocks, as of the pc time now - from the decoder, which never waits for
+//the socket: if it's being read, this one is dropped (there's another along in a second)
+void metUpdate ( const metClockT* clocks, int n, unsigned long overflows, time_f now );
+
+#endif
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2002 Jon Atkins http://www.jonatkins.com/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "record.h"
+#include "capfile.h"
+#include "discipline.h"
+#include "event.h"
+#include "logger.h"
+
+
+//records replayed each time through the event loop (when not in real time)
+#define	REC_REPLAY_BATCH	(256)
+
+
+//-- capture
+
+static FILE*	recCaptureFile;
+static serDevT*	recCaptureDevs[CAP_MAX_DEVS];
+static int	recCaptureLast[CAP_MAX_DEVS];
+static int	recCaptureNumDevs;
+static time_f	recCaptureFlushed;
+
+
+int
+recOpenCapture ( char* filename )
+{
+	if ( strcmp ( filename, "-" ) == 0 )
+		recCaptureFile = stdout;
+	else
+		recCaptureFile = fopen ( filename, "wb" );
+
+	if ( recCaptureFile == NULL )
+		return -1;
+
+	return capWriteHeader ( recCaptureFile );
+}
+
+void
+recCaptureLines ( serDevT* dev, int lines, time_f timef )
+{
+	int	index;
+
+	if ( recCaptureFile == NULL )
+		return;
+
+	for ( index=0; index<recCaptureNumDevs; index++ )
+	{
+		if ( recCaptureDevs[index] == dev )
+			break;
+	}
+
+	if ( index == recCaptureNumDevs )
+	{
+		//a new device - name it before its first change
+		if ( recCaptureNumDevs >= CAP_MAX_DEVS )
+			return;
+
+		recCaptureDevs[index] = dev;
+		recCaptureNumDevs++;
+
+		capWriteDevice ( recCaptureFile, index, dev->dev );
+	}
+	else if ( recCaptureLast[index] == lines )
+		return;
+
+	recCaptureLast[index] = lines;
+
+	capWriteEdge ( recCaptureFile, index, lines, timef );
+
+	//don't lose more than a second if we're killed
+	if ( timef - recCaptureFlushed >= 1.0 || timef < recCaptureFlushed )
+	{
+		fflush ( recCaptureFile );
+		recCaptureFlushed = timef;
+	}
+}
+
+
+//-- replay
+
+static FILE*		recReplayFile;
+static int		recReplayRealtime;
+static recDoneT		recReplayDone;
+static serDevT*		recReplayDevs[CAP_MAX_DEVS];
+
+//the next change to replay (read, but not yet due)
+static capRecordT	recReplayNext;
+static int		recReplayNextValid;
+
+//maps the time in the file onto evtNow()
+static int	recReplayStarted;
+static time_f	recReplayOffset;
+
+
+//read up to the next change - returns 1, or 0 at the end of the file
+static int
+recReadEdge (void)
+{
+	serDevT*	dev;
+	int		ret;
+
+	while ( (ret = capReadRecord ( recReplayFile, &recReplayNext )) > 0 )
+	{
+		if ( recReplayNext.type == CAP_EDGE )
+		{
+			recReplayNextValid = 1;
+			return 1;
+		}
+
+		//only the devices given on the command line are replayed
+		for ( dev = serGetDev ( NULL ); dev != NULL; dev = serGetDev ( dev ) )
+		{
+			if ( strcmp ( dev->dev, recReplayNext.name ) == 0 )
+				break;
+		}
+		recReplayDevs[recReplayNext.index] = dev;
+
+		if ( dev == NULL )
+			loggerf ( LOGGER_DEBUG, "replay: skipping device %s\n", recReplayNext.name );
+	}
+
+	if ( ret < 0 )
+		loggerf ( LOGGER_NOTE, "Error: bad record in replay file\n" );
+
+	return 0;
+}
+
+static void
+recReplayEvent ( evtSourceT* src, void* arg )
+{
+	serDevT*	dev;
+	time_f		when;
+	int		n;
+
+	for ( n=0; n<REC_REPLAY_BATCH; n++ )
+	{
+		if ( !recReplayNextValid && !recReadEdge () )
+		{
+			loggerf ( LOGGER_INFO, "replay finished\n" );
+			evtStopTimer ( src );
+			recReplayDone ();
+			return;
+		}
+
+		if ( recReplayRealtime )
+		{
+			if ( !recReplayStarted )
+			{
+				recReplayOffset = evtNow () - recReplayNext.timef;
+				recReplayStarted = 1;
+			}
+
+			when = recReplayNext.timef + recReplayOffset;
+			if ( when > evtNow () )
+			{
+				evtSetTimerAt ( src, when );
+				return;
+			}
+		}
+
+		dev = recReplayDevs[recReplayNext.index];
+#ifdef ENABLE_DISCIPLINE
+		//(-A disciplines a mock clock - which the capture's times are read through)
+		recReplayNext.timef = discReadTime ( recReplayNext.timef );
+#endif
+		if ( dev != NULL && dev->changed != NULL && serStoreDevStatusLines ( dev, recReplayNext.lines, recReplayNext.timef ) == 1 )
+			dev->changed ( dev );
+
+		recReplayNextValid = 0;
+	}
+
+	//give the rest of the event loop a look in
+	evtSetTimer ( src, 0, 0 );
+}
+
+int
+recStartReplay ( char* filename, int realtime, recDoneT done )
+{
+	evtSourceT*	src;
+
+	if ( strcmp ( filename, "-" ) == 0 )
+		recReplayFile = stdin;
+	else
+		recReplayFile = fopen ( filename, "rb" );
+
+	if ( recReplayFile == NULL )
+		return -1;
+
+	if ( capReadHeader ( recReplayFile ) < 0 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: %s is not a radioclkd2 capture\n", filename );
+		return -1;
+	}
+
+	recReplayRealtime = realtime;
+	recReplayDone = done;
+
+	src = evtAddTimer ( recReplayEvent, NULL );
+	if ( src == NULL )
+		return -1;
+	evtSetTimer ( src, 0, 0 );
+
+	return 0;
+}
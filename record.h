@@ -0,0 +1,25 @@
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include "timef.h"
+#include "serial.h"
+
+
+//the raw line changes on each device can be captured to a file (-c), and replayed later
+//in place of the serial ports (-s replay:FILE) - to reproduce decode failures offline.
+//(the file format is in capfile.h)
+
+//filename may be "-" for stdout/stdin
+int recOpenCapture ( char* filename );
+//called for every change seen on a device, before any filtering
+void recCaptureLines ( serDevT* dev, int lines, time_f timef );
+
+//called once the whole file has been replayed
+typedef void (*recDoneT) (void);
+
+//replay the file through the devices (matched by name) - as fast as possible, or with
+//the gaps between the changes as they were recorded
+int recStartReplay ( char* filename, int realtime, recDoneT done );
+
+
+#endif
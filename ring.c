@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2002 Jon Atkins http://www.jonatkins.com/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "ring.h"
+#include "logger.h"
+#include "memory.h"
+
+
+//head is only written by the producer, and tail only by the consumer - each is published
+//with a release store and read with an acquire load, so no locks are needed.
+//(they're kept on separate cache lines, so the two threads don't fight over one)
+
+#define	RING_CACHELINE	(64)
+
+struct ringS
+{
+	ringEdgeT	edges[RING_SIZE];
+
+	unsigned int	head;
+	char		pad1[RING_CACHELINE - sizeof(unsigned int)];
+	unsigned int	tail;
+	char		pad2[RING_CACHELINE - sizeof(unsigned int)];
+	unsigned int	overflows;
+
+	//the consumer sleeps on this pipe until the producer has something for it
+	int		doorbell[2];
+};
+
+
+ringT*
+ringCreate (void)
+{
+	ringT*	ring;
+
+	ring = safe_mallocz ( sizeof(ringT) );
+
+	if ( pipe ( ring->doorbell ) != 0 )
+	{
+		safe_free ( ring );
+		return NULL;
+	}
+
+	//the event loop must never block on a slow decoder
+	fcntl ( ring->doorbell[1], F_SETFL, O_NONBLOCK );
+
+	return ring;
+}
+
+
+int
+ringPush ( ringT* ring, const ringEdgeT* edge )
+{
+	unsigned int	head, tail;
+
+	head = ring->head;
+	tail = __atomic_load_n ( &ring->tail, __ATOMIC_ACQUIRE );
+
+	if ( head - tail >= RING_SIZE )
+	{
+		__atomic_add_fetch ( &ring->overflows, 1, __ATOMIC_RELAXED );
+		return -1;
+	}
+
+	ring->edges[head & (RING_SIZE-1)] = *edge;
+	__atomic_store_n ( &ring->head, head + 1, __ATOMIC_RELEASE );
+
+	return 0;
+}
+
+void
+ringSignal ( ringT* ring )
+{
+	char	c = 0;
+
+	//if the pipe is full, the consumer has plenty of wakeups pending anyway
+	if ( write ( ring->doorbell[1], &c, 1 ) < 0 && errno != EAGAIN )
+		loggerf ( LOGGER_NOTE, "Error: failed to wake the decoder: %d\n", errno );
+}
+
+
+int
+ringPop ( ringT* ring, ringEdgeT* edge )
+{
+	unsigned int	head, tail;
+
+	tail = ring->tail;
+	head = __atomic_load_n ( &ring->head, __ATOMIC_ACQUIRE );
+
+	if ( head == tail )
+		return 0;
+
+	*edge = ring->edges[tail & (RING_SIZE-1)];
+	__atomic_store_n ( &ring->tail, tail + 1, __ATOMIC_RELEASE );
+
+	return 1;
+}
+
+void
+ringWait ( ringT* ring )
+{
+	char	buf[64];
+
+	//one read takes several wakeups at once - the consumer empties the ring each time
+	if ( read ( ring->doorbell[0], buf, sizeof(buf) ) < 0 && errno != EINTR )
+		loggerf ( LOGGER_NOTE, "Error: failed to wait for the event loop: %d\n", errno );
+}
+
+
+unsigned int
+ringOverflows ( ringT* ring )
+{
+	return __atomic_load_n ( &ring->overflows, __ATOMIC_RELAXED );
+}
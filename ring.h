@@ -0,0 +1,41 @@
+#ifndef RING_H_
+#define RING_H_
+
+#include "timef.h"
+#include "serial.h"
+
+
+//the edges found by the event loop are passed to the decoding thread through a lock-free
+//ring - one producer (the event loop) and one consumer (the decoder), so the next edge is
+//never held up by decoding, logging or publishing the time
+
+typedef struct
+{
+	serLineT*	line;
+	int		state;
+	int		missed;		//edges missed before this one - an erasure, rather than a change
+	time_f		timef;
+	time_f		seen;		//when the event loop read it (0 when replaying)
+} ringEdgeT;
+
+typedef struct ringS ringT;
+
+#define	RING_SIZE	(256)	//must be a power of 2
+
+ringT* ringCreate (void);
+
+//producer: returns -1 (and counts an overflow) if the ring is full
+int ringPush ( ringT* ring, const ringEdgeT* edge );
+//producer: wake the consumer once some edges have been pushed
+void ringSignal ( ringT* ring );
+
+//consumer: returns 1 if an edge was popped, 0 if the ring is empty
+int ringPop ( ringT* ring, ringEdgeT* edge );
+//consumer: block until the producer signals
+void ringWait ( ringT* ring );
+
+//the number of edges dropped because the ring was full
+unsigned int ringOverflows ( ringT* ring );
+
+
+#endif
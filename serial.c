@@ -25,21 +25,37 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <string.h>
+#include <math.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "systime.h"
 #include <sys/ioctl.h>
 #include <stdio.h>
-#include <signal.h>
-#include <setjmp.h>
 #include <sys/errno.h>
 
-#ifdef ENABLE_GPIO
-#include <poll.h>
+#ifdef ENABLE_WAITTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef ENABLE_GPIOCHIP
+#include <linux/gpio.h>
+#endif
+
+#ifdef ENABLE_TIOCGICOUNT
+#include <linux/serial.h>
 #endif
 
 #ifdef ENABLE_TIMEPPS
-#include <sys/timepps.h>
+#include "timepps.h"
+#endif
+
+#ifdef ENABLE_PPS_LDISC
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#ifndef N_PPS
+#define	N_PPS	18
+#endif
 #endif
 
 
@@ -47,7 +63,9 @@
 #include "logger.h"
 
 #include "serial.h"
+#include "record.h"
 #include "memory.h"
+#include "settings.h"
 
 
 static serDevT* 	serDevHead;
@@ -92,7 +110,7 @@ serAddLine ( char* dev, int line, int mode )
 	}
 
 	//make sure only one line bit is set...
-	if ( line & (line-1) )
+	if ( mode != SERPORT_MODE_GPIOCHIP && (line & (line-1)) )
 	{
 		loggerf ( LOGGER_NOTE, "serAddLine(): more than one line bit set\n" );
 		return NULL;
@@ -127,6 +145,39 @@ serAddLine ( char* dev, int line, int mode )
 	}
 
 
+#ifdef ENABLE_GPIOCHIP
+	//gpio chip lines are given by their offset on the chip - give each one the next free line bit
+	if ( mode == SERPORT_MODE_GPIOCHIP )
+	{
+		int	i;
+
+		if ( line < 0 )
+		{
+			loggerf ( LOGGER_NOTE, "serAddLine(): bad gpio line offset %d\n", line );
+			return NULL;
+		}
+
+		for ( i=0; i<serdev->gpionumlines; i++ )
+		{
+			if ( serdev->gpiooffsets[i] == line )
+			{
+				loggerf ( LOGGER_NOTE, "serAddLine(): cannot add gpio line %d more than once\n", line );
+				return NULL;
+			}
+		}
+
+		if ( serdev->gpionumlines >= SERGPIO_MAX_LINES )
+		{
+			loggerf ( LOGGER_NOTE, "serAddLine(): too many gpio lines on one chip\n" );
+			return NULL;
+		}
+
+		serdev->gpiooffsets[serdev->gpionumlines] = line;
+		line = 1 << serdev->gpionumlines;
+		serdev->gpionumlines++;
+	}
+#endif
+
 	//make sure we're not already monitoring this line...
 	if ( serdev->modemlines & line )
 	{
@@ -145,6 +196,9 @@ serAddLine ( char* dev, int line, int mode )
 
 	serline->dev = serdev;
 	serline->line = line;
+#ifdef ENABLE_TIMEPPS
+	serline->ppsfd = -1;
+#endif
 
 	return serline;
 
@@ -172,253 +226,1318 @@ serGetLine ( serLineT* prev )
 
 
 int
-serOpenDev ( serDevT* dev )
+serSetLinePps ( serLineT* line, char* ppsdev )
 {
 #ifdef ENABLE_TIMEPPS
-	pps_params_t	ppsparams;
-	int		ppsmode;
+	if ( line->dev->mode != SERPORT_MODE_TIMEPPS )
+	{
+		loggerf ( LOGGER_NOTE, "serSetLinePps(): pps devices can only be used in timepps mode\n" );
+		return -1;
+	}
+
+	//allow for either full paths or /dev relative paths...
+	if ( strlen(ppsdev)+strlen("/dev/") >= sizeof(line->ppsdev) )
+	{
+		loggerf ( LOGGER_NOTE, "serSetLinePps(): dev too long\n" );
+		return -1;
+	}
+	if ( ppsdev[0] == '/' )
+		strcpy ( line->ppsdev, ppsdev );
+	else
+		sprintf ( line->ppsdev, "/dev/%s", ppsdev );
+
+	return 0;
+#else
+	loggerf ( LOGGER_NOTE, "serSetLinePps(): timepps not available\n" );
+	return -1;
 #endif
+}
 
-	dev->fd = open ( dev->dev, O_RDONLY|O_NOCTTY );
 
-	switch ( dev->mode )
+//-- deglitching each line (see serLineT)
+
+static void serPollLearn ( serDevT* dev, time_f timef );
+
+//the raw level on a line at timef is level, read at seen - returns 1 if the level passed on
+//has changed
+static int
+serGlitchEdge ( serLineT* line, int level, time_f timef, time_f seen )
+{
+	if ( level == line->glitchraw )
+		return 0;
+
+	if ( glitchWidth <= 0 )
 	{
-#ifdef ENABLE_TIMEPPS
-	case SERPORT_MODE_TIMEPPS:
-		if ( time_pps_create ( dev->fd, &dev->ppshandle ) == -1 )
-			return -1;
+		line->glitchraw = level;
+		line->glitchrawtime = timef;
+		line->glitchstate = level;
+		line->glitchtime = timef;
+		line->glitchseen = seen;
+		return 1;
+	}
 
-		if ( time_pps_getparams ( dev->ppshandle, &ppsparams ) == -1 )
-			return -1;
+	if ( !line->glitchpending )
+	{
+		//(the raw level is always the level passed on, when nothing is pending)
+		line->glitchpending = 1;
+		line->glitchpendtime = timef;
+		line->glitchpendseen = seen;
+	}
+	else if ( timef - line->glitchpendtime <= glitchHysteresis )
+	{
+		//bouncing just after the change - the change keeps its time
+		line->glitchbounces++;
+	}
+	else if ( level != line->glitchstate )
+	{
+		//changed, went back, and changed again before either level held - the shorter of
+		//the two is the spike. if that was the first, the change happens now instead
+		line->glitchspikes++;
+		if ( timef - line->glitchrawtime >= line->glitchrawtime - line->glitchpendtime )
+		{
+			line->glitchpendtime = timef;
+			line->glitchpendseen = seen;
+		}
 
-		ppsparams.mode |= PPS_TSFMT_TSPEC | PPS_CAPTUREBOTH;
+		loggerf ( LOGGER_DEBUG, "%s: dropped a spike on line 0x%x at "TIMEF_FORMAT" (%lu so far)\n", line->dev->dev, line->line, line->glitchrawtime, line->glitchspikes );
+	}
+	//else back to the level passed on - a spike if it stays there (see serGlitchFlush())
 
-		if ( time_pps_setparams ( dev->ppshandle, &ppsparams ) == -1 )
-			return -1;
+	line->glitchraw = level;
+	line->glitchrawtime = timef;
 
-		if ( time_pps_getcap ( dev->ppshandle, &ppsmode ) == -1 )
-			return -1;
+	return 0;
+}
 
-		//NOTE: these should probably be error cases, but the code is still experimental and
-		//the PPS support I've used also seems to have problems
-		if ( ! (ppsmode | PPS_CAPTUREASSERT) )
-			loggerf ( LOGGER_NOTE, "Warning: PPS_CAPTUREASSERT not supported\n" );
-		if ( ! (ppsmode | PPS_CAPTURECLEAR) )
-			loggerf ( LOGGER_NOTE, "Warning: PPS_CAPTURECLEAR not supported\n" );
+//pass on the edges missed with a pending change, as it's settled - returns 1 if there were any
+static int
+serGlitchMissed ( serLineT* line )
+{
+	if ( line->glitchmissed == 0 )
+		return 0;
 
-//!!! no point using this - too many problems
-//1. linux doesn't report PPS_CANWAIT, but can
-//2. FreeBSD does report PPS_CANWAIT, but can't
-//(unless its me reading the docs backwards?)
-//		if ( ! (ppsmode | PPS_CANWAIT) )
-//			loggerf ( LOGGER_NOTE, "Warning: PPS_CANWAIT not supported (linux lies)\n" );
+	line->missed += line->glitchmissed;
+	line->missedtime = line->glitchmissedtime;
+	line->glitchmissed = 0;
 
-#endif
+	return 1;
+}
+
+//pass on a pending change once the raw level has held for glitchWidth at timef - returns 1 if
+//the level passed on has changed (or there are missed edges to pass on)
+static int
+serGlitchFlush ( serLineT* line, time_f timef )
+{
+	if ( !line->glitchpending || timef - line->glitchrawtime < glitchWidth )
+		return 0;
+
+	line->glitchpending = 0;
+
+	if ( line->glitchraw == line->glitchstate )
+	{
+		line->glitchspikes++;
+		loggerf ( LOGGER_DEBUG, "%s: dropped a spike on line 0x%x at "TIMEF_FORMAT" (%lu so far)\n", line->dev->dev, line->line, line->glitchpendtime, line->glitchspikes );
+		return serGlitchMissed ( line );
 	}
 
-	return dev->fd;
+	serGlitchMissed ( line );
+
+	line->glitchstate = line->glitchraw;
+	line->glitchtime = line->glitchpendtime;
+	line->glitchseen = line->glitchpendseen;
+
+	return 1;
 }
 
-int
-serInitHardware ( serDevT* dev )
+//start all the lines on a device at their current levels
+static void
+serGlitchReset ( serDevT* dev, int lines, time_f timef )
 {
-	if ( dev->fd < 0 )
-		serOpenDev ( dev );
-
-	if ( dev->fd < 0 )
-		return -1;
+	serLineT*	line;
 
-	//add code to power on the device (set DTR high - maybe other options..?)
+	for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
+	{
+		if ( line->dev != dev )
+			continue;
 
-	//wait for the device to power up...
-	sleep(3);
+		line->glitchraw = lines & line->line;
+		line->glitchrawtime = timef;
+		line->glitchstate = line->glitchraw;
+		line->glitchtime = timef;
+		line->glitchseen = 0;
+		line->glitchpending = 0;
+		line->glitchmissed = 0;
+	}
 
-	return 0;
+	dev->curlines = lines;
+	dev->prevlines = lines;
+	dev->eventtime = timef;
 }
 
+//the deglitched levels have changed - dev->eventtime is the latest change (each line keeps
+//the time of its own, for serUpdateLinesForDevice())
+static void
+serGlitchStore ( serDevT* dev )
+{
+	serLineT*	line;
+	int		lines, first;
+
+	lines = 0;
+	first = 1;
+	for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
+	{
+		if ( line->dev != dev )
+			continue;
 
-//static jmp_buf alrmjump;
+		lines |= line->glitchstate;
 
-#ifdef ENABLE_TIOCMIWAIT
+		if ( line->glitchstate != (dev->curlines & line->line) && ( first || line->glitchtime > dev->eventtime ) )
+		{
+			dev->eventtime = line->glitchtime;
+			first = 0;
+		}
+	}
+
+	dev->prevlines = dev->curlines;
+	dev->curlines = lines;
+
+	//(every change passed on, whether it was polled or held until the glitch timer)
+	if ( dev->mode == SERPORT_MODE_POLL && !first )
+		serPollLearn ( dev, dev->eventtime );
+}
+
+//wake up when the first pending change on a device will have held for glitchWidth
 static void
-sigalrm ( int sig )
+serGlitchArm ( serDevT* dev )
 {
-	//empty func - just used so that ioctl() aborts on an alarm()
+	serLineT*	line;
+	struct timeval	tv;
+	time_f		deadline;
+	time_f		timef;
+
+	if ( dev->glitchtimer == NULL )
+		return;
+
+	deadline = 0;
+	for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
+	{
+		if ( line->dev == dev && line->glitchpending && ( deadline == 0 || line->glitchrawtime < deadline ) )
+			deadline = line->glitchrawtime;
+	}
+
+	if ( deadline == 0 )
+	{
+		evtStopTimer ( dev->glitchtimer );
+		return;
+	}
+
+	//(the edge times are wall clock times, the timers run on the monotonic clock)
+	gettimeofday ( &tv, NULL );
+	timeval2time_f ( &tv, timef );
+	evtSetTimerAt ( dev->glitchtimer, evtNow () + deadline + glitchWidth - timef );
 }
-#endif
 
-int
-serWaitForSerialChange ( serDevT* dev )
+//nothing more has happened on the lines, so the pending changes have held
+static void
+serGlitchTimer ( evtSourceT* src, void* arg )
 {
-	struct timeval tv;
-	time_f	timef;
-	int	i,ret;
-#ifdef ENABLE_TIMEPPS
-	struct timespec timeout;
-	pps_info_t	ppsinfo;
-	int		ppslines;
-#endif
-#ifdef ENABLE_GPIO
-	struct pollfd  pollfds[1];
-#endif
+	serDevT*	dev = arg;
+	serLineT*	line;
+	struct timeval	tv;
+	time_f		timef;
+	int		changed;
 
-	if ( dev->modemlines == 0 )
-		return -1;
+	gettimeofday ( &tv, NULL );
+	timeval2time_f ( &tv, timef );
 
-	switch ( dev->mode )
+	changed = 0;
+	for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
 	{
-	case SERPORT_MODE_POLL:
+		if ( line->dev == dev )
+			changed |= serGlitchFlush ( line, timef );
+	}
 
-		for ( i=0; i<10*1000; i++ )
-		{
-			gettimeofday ( &tv, NULL );
-			timeval2time_f ( &tv, timef );
-			ret = serGetDevStatusLines ( dev, timef );
-			if ( ret < 0 )
-				return -1;
-			if ( ret == 1 )
-				return 0;
+	if ( changed )
+	{
+		serGlitchStore ( dev );
+		dev->changed ( dev );
+	}
 
-			usleep ( 1000 );
-		}
+	serGlitchArm ( dev );
+}
 
-		//timeout
-		return -1;
-		break;
 
-#ifdef ENABLE_GPIO
-	case SERPORT_MODE_GPIO:
-		pollfds[0].fd = dev->fd;
-		pollfds[0].events = POLLERR;
+#ifdef ENABLE_GPIOCHIP
 
-		i = poll(pollfds, 1, 10000); /* timeout 10 seconds */
-		if (i != 1 && !(pollfds[0].revents & POLLERR) )
-			return -1;
+//request all the lines for a gpio chip device with one GPIO_V2_GET_LINE_IOCTL - edge events for
+//both edges, timestamped by the kernel when the interrupt happened.
+//kernel debounce and realtime timestamps are used if the kernel supports them
+static int
+serGpioRequestLines ( serDevT* dev )
+{
+	struct gpio_v2_line_request	req;
+	struct gpio_v2_line_values	values;
+	int		i;
+	int		debounce;
+	time_f		now;
+	struct timeval	tv;
 
-		gettimeofday ( &tv, NULL );
-		timeval2time_f ( &tv, timef );
+	if ( dev->fd < 0 )
+		return -1;
 
-		if ( serGetDevStatusLines ( dev, timef ) < 0 )
-			return -1;
+	debounce = gpioDebounceUsec;
+#if HAVE_DECL_GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME
+	dev->gpiorealtime = 1;
+#else
+	//(the headers are from before 5.11 - the timestamps are always monotonic)
+	dev->gpiorealtime = 0;
+#endif
 
-		return 0;
-		break;
+	while ( 1 )
+	{
+		memset ( &req, 0, sizeof(req) );
+
+		for ( i=0; i<dev->gpionumlines; i++ )
+			req.offsets[i] = dev->gpiooffsets[i];
+		req.num_lines = dev->gpionumlines;
+		strncpy ( req.consumer, "radioclkd2", sizeof(req.consumer)-1 );
+
+		req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+#if HAVE_DECL_GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME
+		if ( dev->gpiorealtime )
+			req.config.flags |= GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME;
 #endif
 
+		if ( debounce > 0 )
+		{
+			req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+			req.config.attrs[0].attr.debounce_period_us = debounce;
+			req.config.attrs[0].mask = (1ULL << dev->gpionumlines) - 1;
+			req.config.num_attrs = 1;
+		}
 
-#ifdef ENABLE_TIOCMIWAIT
-	case SERPORT_MODE_IWAIT:
-		signal ( SIGALRM, sigalrm );
-		alarm ( 10 );
+		if ( ioctl ( dev->fd, GPIO_V2_GET_LINE_IOCTL, &req ) == 0 )
+			break;
 
-		if ( ioctl ( dev->fd, TIOCMIWAIT, dev->modemlines) != 0 )
+		//fall back on what older kernels can do - debounce first, then realtime timestamps
+		if ( errno != EINVAL )
+		{
+			loggerf ( LOGGER_NOTE, "Error: failed to request gpio lines on %s: %s\n", dev->dev, strerror(errno) );
+			return -1;
+		}
+		if ( debounce > 0 )
+		{
+			loggerf ( LOGGER_NOTE, "Warning: kernel debounce not available on %s\n", dev->dev );
+			debounce = 0;
+		}
+		else if ( dev->gpiorealtime )
+		{
+			loggerf ( LOGGER_INFO, "realtime gpio timestamps not available on %s - converting from monotonic\n", dev->dev );
+			dev->gpiorealtime = 0;
+		}
+		else
+		{
+			loggerf ( LOGGER_NOTE, "Error: failed to request gpio lines on %s: %s\n", dev->dev, strerror(errno) );
 			return -1;
+		}
+	}
+
+	//we don't need the chip any more - just the lines...
+	close ( dev->fd );
+	dev->fd = req.fd;
+
+	//start with the current line levels
+	memset ( &values, 0, sizeof(values) );
+	values.mask = (1ULL << dev->gpionumlines) - 1;
+	if ( ioctl ( dev->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values ) == 0 )
+	{
 		gettimeofday ( &tv, NULL );
-		timeval2time_f ( &tv, timef );
+		timeval2time_f ( &tv, now );
 
-		signal ( SIGALRM, SIG_DFL );
-		alarm ( 0 );
+		dev->gpiolines = (int)values.bits;
+		serGlitchReset ( dev, dev->gpiolines, now );
+	}
 
-		if ( serGetDevStatusLines ( dev, timef ) < 0 )
-			return -1;
+	return 0;
+}
 
-		return 0;
-		break;
 #endif
 
-#ifdef ENABLE_TIMEPPS
-	case SERPORT_MODE_TIMEPPS:
-		timeout.tv_sec = 0;
-		timeout.tv_nsec = 0;
+#ifdef ENABLE_PPS_LDISC
+
+//a plain serial port on Linux can only be used for timepps once it has the pps line
+//discipline (what "ldattach PPS" does) - this creates a /dev/ppsN device for its DCD line.
+//returns 0 (and sets ppsdev for a DCD line without one) if the ldisc is attached, or if the
+//device already is a pps device. fails if another line has no pps device of its own.
+static int
+serPpsAttachLdisc ( serDevT* dev )
+{
+	serLineT*	line;
+	pps_handle_t	handle;
+	pps_params_t	ppsparams;
+	int		ldisc;
+	DIR*		dir;
+	struct dirent*	ent;
+	char		path[PATH_MAX];
+	char		devpath[PATH_MAX];
+	char		ppspath[64];
+	FILE*		file;
+	int		found;
+
+	//is it already a pps device (eg. /dev/pps0 from pps-gpio)?
+	if ( time_pps_create ( dev->fd, &handle ) == 0 && time_pps_getparams ( handle, &ppsparams ) == 0 )
+		return 0;
 
-		for ( i=0; i<10*100; i++ )
+	//the line discipline only timestamps DCD - any other line without its own pps device
+	//can't be served by it
+	for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
+	{
+		if ( line->dev == dev && line->ppsdev[0] == 0 && line->line != TIOCM_CD )
 		{
-			if ( time_pps_fetch ( dev->ppshandle, PPS_TSFMT_TSPEC, &ppsinfo, &timeout ) == -1 )
-			{
-				loggerf ( LOGGER_NOTE, "ppsfetch failed: %d\n", errno );
-				return -1;
-			}
+			loggerf ( LOGGER_DEBUG, "pps line discipline can't timestamp the non-DCD lines of %s\n", dev->dev );
+			return -1;
+		}
+	}
 
-			if ( ppsinfo.assert_sequence != dev->ppslastassert )
-			{
-				timespec2time_f ( &ppsinfo.assert_timestamp, timef );
-				ppslines = TIOCM_CD;	//NOTE: assuming that pps support is on the DCD line
-				dev->ppslastassert = ppsinfo.assert_sequence;
+	ldisc = N_PPS;
+	if ( ioctl ( dev->fd, TIOCSETD, &ldisc ) != 0 )
+	{
+		loggerf ( LOGGER_DEBUG, "failed to set the pps line discipline on %s: %s\n", dev->dev, strerror(errno) );
+		return -1;
+	}
 
-				if ( serStoreDevStatusLines ( dev, ppslines, timef ) < 0 )
-					return -1;
-				return 0;
-			}
-			else if ( ppsinfo.clear_sequence != dev->ppslastclear )
-			{
-				timespec2time_f ( &ppsinfo.clear_timestamp, timef );
-				ppslines = 0;
-				dev->ppslastclear = ppsinfo.clear_sequence;
+	//find the pps device the line discipline has just created - its path is the serial port
+	if ( realpath ( dev->dev, devpath ) == NULL )
+		strcpy ( devpath, dev->dev );
 
-				if ( serStoreDevStatusLines ( dev, ppslines, timef ) < 0 )
-					return -1;
-				return 0;
-			}
+	dir = opendir ( "/sys/class/pps" );
+	if ( dir == NULL )
+		return -1;
+
+	found = 0;
+	while ( !found && (ent = readdir ( dir )) != NULL )
+	{
+		if ( strncmp ( ent->d_name, "pps", 3 ) != 0 )
+			continue;
+
+		snprintf ( path, sizeof(path), "/sys/class/pps/%s/path", ent->d_name );
+		file = fopen ( path, "r" );
+		if ( file == NULL )
+			continue;
 
-			usleep ( 10000 );
+		if ( fgets ( path, sizeof(path), file ) != NULL )
+		{
+			path[strcspn ( path, "\n" )] = 0;
+			if ( strcmp ( path, devpath ) == 0 || strcmp ( path, dev->dev ) == 0 )
+			{
+				snprintf ( ppspath, sizeof(ppspath), "/dev/%.32s", ent->d_name );
+				found = 1;
+			}
 		}
+		fclose ( file );
+	}
+	closedir ( dir );
 
+	if ( !found )
+	{
+		loggerf ( LOGGER_DEBUG, "no pps device found for %s\n", dev->dev );
 		return -1;
-		break;
-#endif
-
 	}
 
-	loggerf ( LOGGER_NOTE, "Error: serWaitForSerialChange(): mode not supported\n" );
+	loggerf ( LOGGER_INFO, "attached pps line discipline to %s as %s\n", dev->dev, ppspath );
 
-	//unknown serial port mode !!
-	return -1;
+	for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
+	{
+		if ( line->dev == dev && line->ppsdev[0] == 0 && line->line == TIOCM_CD )
+			strcpy ( line->ppsdev, ppspath );
+	}
 
+	return 0;
 }
 
-int
-serGetDevStatusLines ( serDevT* dev, time_f timef )
+//the pps line discipline isn't available - wait for serial port interrupts instead.
+//(not possible if some lines need their own pps devices)
+static int
+serPpsFallback ( serDevT* dev )
 {
-	int	lines;
+	serLineT*	line;
 
-#ifdef ENABLE_GPIO
-	char    buf[8];
-	if (dev->mode == SERPORT_MODE_GPIO) {
-		if (lseek(dev->fd, SEEK_SET, 0) == -1)
-			return -1;
-		if (read(dev->fd, buf, sizeof(buf)) <= 0)
+	for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
+	{
+		if ( line->dev == dev && line->ppsdev[0] != 0 )
 			return -1;
-
-		if (buf[0] == '1')
-			lines = TIOCM_CD;
-		else
-			lines = 0;
-
-		return serStoreDevStatusLines ( dev, lines, timef );
 	}
-#endif
 
-	if ( ioctl ( dev->fd, TIOCMGET, &lines ) != 0 )
-		return -1;
+#ifdef ENABLE_TIOCMIWAIT
+	dev->mode = SERPORT_MODE_IWAIT;
+	loggerf ( LOGGER_NOTE, "pps not available on %s - using iwait\n", dev->dev );
+#else
+	dev->mode = SERPORT_MODE_POLL;
+	loggerf ( LOGGER_NOTE, "pps not available on %s - using poll\n", dev->dev );
+#endif
 
-	return serStoreDevStatusLines ( dev, lines, timef );
+	return 0;
 }
 
-int
-serStoreDevStatusLines ( serDevT* dev, int lines, time_f timef )
-{
+#endif
 
-	time_f diff = timef - dev->eventtime;
-	if (diff < 0.05) {
-		loggerf ( LOGGER_DEBUG, "serStoreDevStatusLines: pulse too short %f, filtering!\n", diff);
+#ifdef ENABLE_TIMEPPS
+
+//open the pps source for a line, and start capturing both edges
+static int
+serPpsOpenLine ( serLineT* line )
+{
+	pps_params_t	ppsparams;
+	int		ppsmode;
+	char*		ppsname;
+
+	if ( line->ppsdev[0] == 0 )
+	{
+		//the serial port's own pps support only timestamps DCD
+		if ( line->line != TIOCM_CD )
+		{
+			loggerf ( LOGGER_NOTE, "Error: %s: only DCD can be timestamped by the serial port - give a pps device with -p\n", line->dev->dev );
+			return -1;
+		}
+		line->ppsfd = line->dev->fd;
+		ppsname = line->dev->dev;
+	}
+	else
+	{
+		line->ppsfd = open ( line->ppsdev, O_RDWR );
+		ppsname = line->ppsdev;
+	}
+
+	if ( line->ppsfd < 0 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: failed to open pps device %s\n", ppsname );
+		return -1;
+	}
+
+	if ( time_pps_create ( line->ppsfd, &line->ppshandle ) == -1 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: %s is not a pps device\n", ppsname );
+		return -1;
+	}
+
+	if ( time_pps_getparams ( line->ppshandle, &ppsparams ) == -1 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: failed to get pps parameters on %s\n", ppsname );
+		return -1;
+	}
+
+	ppsparams.mode |= PPS_TSFMT_TSPEC | PPS_CAPTUREBOTH;
+
+	if ( time_pps_setparams ( line->ppshandle, &ppsparams ) == -1 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: failed to set pps parameters on %s\n", ppsname );
+		return -1;
+	}
+
+	if ( time_pps_getcap ( line->ppshandle, &ppsmode ) == -1 )
+		return -1;
+
+	//NOTE: these should probably be error cases, but the code is still experimental and
+	//the PPS support I've used also seems to have problems
+	if ( ! (ppsmode & PPS_CAPTUREASSERT) )
+		loggerf ( LOGGER_NOTE, "Warning: PPS_CAPTUREASSERT not supported on %s\n", ppsname );
+	if ( ! (ppsmode & PPS_CAPTURECLEAR) )
+		loggerf ( LOGGER_NOTE, "Warning: PPS_CAPTURECLEAR not supported on %s\n", ppsname );
+
+//!!! no point using this - too many problems
+//1. linux doesn't report PPS_CANWAIT, but can
+//2. FreeBSD does report PPS_CANWAIT, but can't
+//(unless its me reading the docs backwards?)
+//		if ( ! (ppsmode & PPS_CANWAIT) )
+//			loggerf ( LOGGER_NOTE, "Warning: PPS_CANWAIT not supported (linux lies)\n" );
+
+	loggerf ( LOGGER_INFO, "pps source %s for %s\n", ppsname, line->dev->dev );
+
+	return 0;
+}
+
+#endif
+
+
+int
+serOpenDev ( serDevT* dev )
+{
+#ifdef ENABLE_TIMEPPS
+	serLineT*	line;
+#endif
+
+	dev->fd = open ( dev->dev, O_RDONLY|O_NOCTTY );
+
+	switch ( dev->mode )
+	{
+#ifdef ENABLE_GPIOCHIP
+	case SERPORT_MODE_GPIOCHIP:
+		//all the lines are requested together, and dev->fd becomes the line request
+		if ( serGpioRequestLines ( dev ) < 0 )
+		{
+			if ( dev->fd >= 0 )
+				close ( dev->fd );
+			dev->fd = -1;
+			return -1;
+		}
+		break;
+#endif
+
+#ifdef ENABLE_TIMEPPS
+	case SERPORT_MODE_TIMEPPS:
+#ifdef ENABLE_PPS_LDISC
+		if ( dev->fd >= 0 && serPpsAttachLdisc ( dev ) < 0 )
+		{
+			if ( serPpsFallback ( dev ) == 0 )
+				break;
+
+			loggerf ( LOGGER_NOTE, "Error: failed to set the pps line discipline on %s - lines other than DCD need their own pps device, with -p\n", dev->dev );
+			return -1;
+		}
+#endif
+		for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
+		{
+			if ( line->dev == dev && serPpsOpenLine ( line ) < 0 )
+				return -1;
+		}
+		break;
+#endif
+	}
+
+	return dev->fd;
+}
+
+int
+serInitHardware ( serDevT* dev )
+{
+	//nothing to open - the replay drives the device
+	if ( dev->mode == SERPORT_MODE_REPLAY )
+		return 0;
+
+	if ( dev->fd < 0 && serOpenDev ( dev ) < 0 )
+		return -1;
+
+	if ( dev->fd < 0 )
+		return -1;
+
+	//add code to power on the device (set DTR high - maybe other options..?)
+
+	//wait for the device to power up...
+	sleep(3);
+
+	return 0;
+}
+
+
+//-- event sources for each serial port mode
+//each one finds the new modem lines (and the time they changed), stores them,
+//and tells the owner of the device via dev->changed()
+
+
+//each edge adds SERPOLL_HIT to the bin for its phase, and every SERPOLL_DECAY edges the
+//histogram is halved, so the windows follow the clock as the edges move
+#define	SERPOLL_HIT		(16)
+#define	SERPOLL_DECAY		(256)
+#define	SERPOLL_THRESHOLD	(32)
+#define	SERPOLL_LOCK_EDGES	(10)
+
+static int
+serPollBin ( time_f timef )
+{
+	int	bin;
+
+	bin = (int)( (timef - floor ( timef )) * SERPOLL_BINS );
+	if ( bin < 0 || bin >= SERPOLL_BINS )
+		bin = 0;
+
+	return bin;
+}
+
+//learn the phase of a new edge - and lose lock if it wasn't where it was expected
+static void
+serPollLearn ( serDevT* dev, time_f timef )
+{
+	int	bin, i;
+
+	bin = serPollBin ( timef );
+
+	if ( dev->pollwindow[bin] )
+	{
+		if ( ++dev->pollhits >= SERPOLL_LOCK_EDGES && !dev->polllocked )
+		{
+			loggerf ( LOGGER_DEBUG, "poll scheduler locked on %s\n", dev->dev );
+			dev->polllocked = 1;
+		}
+	}
+	else
+	{
+		if ( dev->polllocked )
+			loggerf ( LOGGER_DEBUG, "poll scheduler lost lock on %s\n", dev->dev );
+		dev->pollhits = 0;
+		dev->polllocked = 0;
+	}
+
+	dev->pollhist[bin] += SERPOLL_HIT;
+	if ( ++dev->polledges >= SERPOLL_DECAY )
+	{
+		dev->polledges = 0;
+		for ( i=0; i<SERPOLL_BINS; i++ )
+			dev->pollhist[i] /= 2;
+	}
+
+	//the windows are the bins with enough edges, widened by a bin either side for jitter
+	memset ( dev->pollwindow, 0, sizeof(dev->pollwindow) );
+	for ( i=0; i<SERPOLL_BINS; i++ )
+	{
+		if ( dev->pollhist[i] >= SERPOLL_THRESHOLD )
+		{
+			dev->pollwindow[(i + SERPOLL_BINS - 1) % SERPOLL_BINS] = 1;
+			dev->pollwindow[i] = 1;
+			dev->pollwindow[(i + 1) % SERPOLL_BINS] = 1;
+		}
+	}
+}
+
+//how long to sleep before the next poll
+static time_f
+serPollDelay ( serDevT* dev, time_f timef )
+{
+	int	bin, i;
+	time_f	delay;
+
+	if ( !dev->polllocked )
+		return SERPOLL_UNLOCKED;
+
+	bin = serPollBin ( timef );
+	if ( dev->pollwindow[bin] )
+		return SERPOLL_DENSE;
+
+	//sleep until the start of the next window (but check now and then anyway)
+	for ( i=1; i<SERPOLL_BINS; i++ )
+	{
+		if ( dev->pollwindow[(bin + i) % SERPOLL_BINS] )
+			break;
+	}
+
+	delay = floor ( timef ) + (time_f)(bin + i) / SERPOLL_BINS - timef;
+	if ( delay > SERPOLL_SPARSE )
+		delay = SERPOLL_SPARSE;
+
+	return delay;
+}
+
+static void
+serPollTimer ( evtSourceT* src, void* arg )
+{
+	serDevT*	dev = arg;
+	struct timeval	tv;
+	time_f		timef;
+	time_f		now;
+
+	now = evtNow ();
+	gettimeofday ( &tv, NULL );
+	timeval2time_f ( &tv, timef );
+
+	//(the change is learnt from as it's stored - see serGlitchStore())
+	if ( serGetDevStatusLines ( dev, timef ) == 1 )
+		dev->changed ( dev );
+
+	//the wakeups are absolute, so time spent decoding doesn't push the windows back
+	evtSetTimerAt ( src, now + serPollDelay ( dev, timef ) );
+}
+
+
+#ifdef ENABLE_GPIO
+static void
+serGpioEvent ( evtSourceT* src, void* arg )
+{
+	serDevT*	dev = arg;
+	struct timeval	tv;
+	time_f		timef;
+
+	gettimeofday ( &tv, NULL );
+	timeval2time_f ( &tv, timef );
+
+	if ( serGetDevStatusLines ( dev, timef ) == 1 )
+		dev->changed ( dev );
+}
+#endif
+
+
+#ifdef ENABLE_GPIOCHIP
+static void
+serGpioChipEvent ( evtSourceT* src, void* arg )
+{
+	serDevT*	dev = arg;
+	struct gpio_v2_line_event	events[SERGPIO_EVENT_BATCH];
+	ssize_t		len;
+	int		i, n, bit;
+	time_f		timef;
+	time_f		clockoffset;
+	struct timeval	tv;
+	struct timespec	ts;
+
+	//read as many events as are waiting in one go...
+	len = read ( dev->fd, events, sizeof(events) );
+	if ( len < (ssize_t)sizeof(events[0]) )
+		return;
+	n = len / sizeof(events[0]);
+
+	//older kernels can only timestamp with CLOCK_MONOTONIC
+	clockoffset = 0;
+	if ( !dev->gpiorealtime )
+	{
+		gettimeofday ( &tv, NULL );
+		timeval2time_f ( &tv, clockoffset );
+		clock_gettime ( CLOCK_MONOTONIC, &ts );
+		clockoffset -= (time_f)ts.tv_sec + (time_f)ts.tv_nsec / (time_f)1000000000.0;
+	}
+
+	for ( i=0; i<n; i++ )
+	{
+		for ( bit=0; bit<dev->gpionumlines; bit++ )
+		{
+			if ( dev->gpiooffsets[bit] == (int)events[i].offset )
+				break;
+		}
+		if ( bit >= dev->gpionumlines )
+			continue;
+
+		//the kernel keeps a per-line sequence number - a gap means its event buffer overflowed
+		if ( dev->gpioseqno[bit] != 0 && events[i].line_seqno != dev->gpioseqno[bit] + 1 )
+			loggerf ( LOGGER_DEBUG, "gpio line %d: %u events lost\n", dev->gpiooffsets[bit], events[i].line_seqno - dev->gpioseqno[bit] - 1 );
+		dev->gpioseqno[bit] = events[i].line_seqno;
+
+		if ( events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE )
+			dev->gpiolines |= 1 << bit;
+		else
+			dev->gpiolines &= ~(1 << bit);
+
+		timef = (time_f)(events[i].timestamp_ns / 1000000000ULL)
+			+ (time_f)(events[i].timestamp_ns % 1000000000ULL) / (time_f)1000000000.0
+			+ clockoffset;
+
+		if ( serStoreDevStatusLines ( dev, dev->gpiolines, timef ) == 1 )
+			dev->changed ( dev );
+	}
+}
+#endif
+
+
+#ifdef ENABLE_WAITTHREAD
+
+//some modes can only wait for a change by blocking, so they wait in their own thread and
+//pass the new lines (and when they changed) back to the event loop through a pipe
+
+typedef struct
+{
+	int	mask;	//the lines this event is for
+	int	lines;
+	time_f	timef;
+	int	missedlines;	//lines that toggled unseen before this event
+	int	missed;		//how many edges were missed (the most on any of missedlines)
+} serWaitEventT;
+
+//pass missed edges on to the lines - the clocks treat them as erasures. a line with a change
+//still being deglitched keeps them until it's passed on, so they don't arrive ahead of it.
+//returns 1 if any are to be passed on now
+static int
+serMissedEdges ( serDevT* dev, int missedlines, int missed, time_f timef )
+{
+	serLineT*	line;
+	int		now;
+
+	now = 0;
+	for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
+	{
+		if ( line->dev != dev || !(line->line & missedlines) )
+			continue;
+
+		if ( line->glitchpending )
+		{
+			line->glitchmissed += missed;
+			line->glitchmissedtime = timef;
+		}
+		else
+		{
+			line->missed += missed;
+			line->missedtime = timef;
+			now = 1;
+		}
+	}
+
+	return now;
+}
+
+static void
+serWaitEvent ( evtSourceT* src, void* arg )
+{
+	serDevT*	dev = arg;
+	serWaitEventT	events[4];
+	ssize_t		len;
+	int		i, n;
+	int		changed;
+
+	len = read ( dev->waitpipe[0], events, sizeof(events) );
+	if ( len < (ssize_t)sizeof(events[0]) )
+		return;
+	n = len / sizeof(events[0]);
+
+	for ( i=0; i<n; i++ )
+	{
+		dev->waitlines = (dev->waitlines & ~events[i].mask) | (events[i].lines & events[i].mask);
+
+		changed = ( serStoreDevStatusLines ( dev, dev->waitlines, events[i].timef ) == 1 );
+
+		if ( events[i].missedlines != 0 && serMissedEdges ( dev, events[i].missedlines, events[i].missed, events[i].timef ) )
+			changed = 1;
+
+		if ( changed )
+			dev->changed ( dev );
+	}
+
+#ifdef ENABLE_TIOCMIWAIT
+	if ( dev->waittimer != NULL )
+		evtSetTimer ( dev->waittimer, SERIWAIT_TIMEOUT, 0 );
+#endif
+}
+
+static int
+serStartWaitPipe ( serDevT* dev )
+{
+	if ( pipe ( dev->waitpipe ) != 0 )
+		return -1;
+
+	dev->evtsrc = evtAddFd ( dev->waitpipe[0], EVT_READ, serWaitEvent, dev );
+	if ( dev->evtsrc == NULL )
+		return -1;
+
+	return 0;
+}
+
+static int
+serStartWaiter ( serDevT* dev, pthread_t* thread, void* (*waiter)(void*), void* arg )
+{
+	if ( pthread_create ( thread, NULL, waiter, arg ) != 0 )
+	{
+		loggerf ( LOGGER_NOTE, "Error: failed to start waiter thread for %s\n", dev->dev );
+		return -1;
+	}
+
+	return 0;
+}
+
+#endif
+
+
+#ifdef ENABLE_TIOCMIWAIT
+
+#ifdef ENABLE_TIOCGICOUNT
+//count the edges on a line that the interrupt counter saw, but the wait didn't
+static void
+serIcountMissed ( serDevT* dev, serWaitEventT* event, int line, int count, int lastlines )
+{
+	int	missed;
+
+	if ( !(dev->modemlines & line) )
+		return;
+
+	missed = count - ( ((event->lines ^ lastlines) & line) ? 1 : 0 );
+
+	//an edge just after the lines were read is counted now, but seen next time - so only
+	//pairs of edges are really missed
+	missed &= ~1;
+
+	if ( missed > 0 )
+	{
+		event->missedlines |= line;
+		if ( missed > event->missed )
+			event->missed = missed;
+	}
+}
+#endif
+
+static void*
+serIwaitThread ( void* arg )
+{
+	serDevT*	dev = arg;
+	serWaitEventT	event;
+	struct timeval	tv;
+	int		ret;
+#ifdef ENABLE_TIOCGICOUNT
+	struct serial_icounter_struct	icount, lasticount;
+	int		haveicount;
+	int		lastlines;
+#endif
+
+	//the wait is cancelled by serIwaitTimeout() - only ever while blocked in TIOCMIWAIT,
+	//never while holding a lock (eg. in loggerf)
+	pthread_setcancelstate ( PTHREAD_CANCEL_DISABLE, NULL );
+	pthread_setcanceltype ( PTHREAD_CANCEL_ASYNCHRONOUS, NULL );
+
+#ifdef ENABLE_TIOCGICOUNT
+	//not every driver keeps the counts (eg. some usb serial adaptors)
+	haveicount = ( ioctl ( dev->fd, TIOCGICOUNT, &lasticount ) == 0 );
+	if ( ioctl ( dev->fd, TIOCMGET, &lastlines ) != 0 )
+		haveicount = 0;
+#endif
+
+	while ( 1 )
+	{
+		pthread_setcancelstate ( PTHREAD_CANCEL_ENABLE, NULL );
+		ret = ioctl ( dev->fd, TIOCMIWAIT, dev->modemlines );
+		pthread_setcancelstate ( PTHREAD_CANCEL_DISABLE, NULL );
+
+		if ( ret != 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+
+			loggerf ( LOGGER_NOTE, "Error: TIOCMIWAIT failed on %s: %d\n", dev->dev, errno );
+			sleep ( 1 );
+			continue;
+		}
+		gettimeofday ( &tv, NULL );
+		timeval2time_f ( &tv, event.timef );
+
+		if ( ioctl ( dev->fd, TIOCMGET, &event.lines ) != 0 )
+			continue;
+		event.mask = dev->modemlines;
+		event.missedlines = 0;
+		event.missed = 0;
+
+#ifdef ENABLE_TIOCGICOUNT
+		//more than one edge since the last wait? (RNG only counts one way)
+		if ( haveicount && ioctl ( dev->fd, TIOCGICOUNT, &icount ) == 0 )
+		{
+			serIcountMissed ( dev, &event, TIOCM_CD, icount.dcd - lasticount.dcd, lastlines );
+			serIcountMissed ( dev, &event, TIOCM_CTS, icount.cts - lasticount.cts, lastlines );
+			serIcountMissed ( dev, &event, TIOCM_DSR, icount.dsr - lasticount.dsr, lastlines );
+			lasticount = icount;
+		}
+		lastlines = event.lines;
+#endif
+
+		if ( write ( dev->waitpipe[1], &event, sizeof(event) ) != sizeof(event) )
+			loggerf ( LOGGER_NOTE, "Error: failed to pass serial event for %s\n", dev->dev );
+	}
+
+	return NULL;
+}
+
+//nothing from the wait for SERIWAIT_TIMEOUT - cancel and restart it, and pick up the
+//lines in case a change was lost
+static void
+serIwaitTimeout ( evtSourceT* src, void* arg )
+{
+	serDevT*	dev = arg;
+	struct timeval	tv;
+	time_f		timef;
+	int		lines;
+
+	pthread_cancel ( dev->waiter );
+	pthread_join ( dev->waiter, NULL );
+
+	loggerf ( LOGGER_DEBUG, "no serial events on %s - restarting the wait\n", dev->dev );
+
+	if ( ioctl ( dev->fd, TIOCMGET, &lines ) == 0 )
+	{
+		gettimeofday ( &tv, NULL );
+		timeval2time_f ( &tv, timef );
+
+		dev->waitlines = lines;
+		if ( serStoreDevStatusLines ( dev, lines, timef ) == 1 )
+			dev->changed ( dev );
+	}
+
+	if ( serStartWaiter ( dev, &dev->waiter, serIwaitThread, dev ) == 0 )
+		evtSetTimer ( src, SERIWAIT_TIMEOUT, 0 );
+}
+#endif
+
+
+#ifdef ENABLE_TIMEPPS
+
+//find the new edges in a pps fetch for a line. an assert and a clear can both arrive
+//between two fetches, so there can be two - they are returned in the order they happened
+static int
+serPpsNewEdges ( serLineT* line, pps_info_t* ppsinfo, int* lines, time_f* timef )
+{
+	int	n;
+
+	n = 0;
+
+	if ( ppsinfo->assert_sequence != line->ppslastassert )
+	{
+		if ( ppsinfo->assert_sequence - line->ppslastassert > 1 && line->ppslastassert != 0 )
+			loggerf ( LOGGER_DEBUG, "pps: %s: %d assert edges missed\n", line->dev->dev, (int)(ppsinfo->assert_sequence - line->ppslastassert - 1) );
+
+		timespec2time_f ( &ppsinfo->assert_timestamp, timef[n] );
+		lines[n] = line->line;
+		line->ppslastassert = ppsinfo->assert_sequence;
+		n++;
+	}
+
+	if ( ppsinfo->clear_sequence != line->ppslastclear )
+	{
+		if ( ppsinfo->clear_sequence - line->ppslastclear > 1 && line->ppslastclear != 0 )
+			loggerf ( LOGGER_DEBUG, "pps: %s: %d clear edges missed\n", line->dev->dev, (int)(ppsinfo->clear_sequence - line->ppslastclear - 1) );
+
+		timespec2time_f ( &ppsinfo->clear_timestamp, timef[n] );
+		lines[n] = 0;
+		line->ppslastclear = ppsinfo->clear_sequence;
+		n++;
+	}
+
+	if ( n == 2 && timef[1] < timef[0] )
+	{
+		time_f	t;
+		int	l;
+
+		t = timef[0]; timef[0] = timef[1]; timef[1] = t;
+		l = lines[0]; lines[0] = lines[1]; lines[1] = l;
+	}
+
+	return n;
+}
+
+#ifndef ENABLE_TIMEPPS_WAIT
+static void
+serPpsTimer ( evtSourceT* src, void* arg )
+{
+	serDevT*	dev = arg;
+	serLineT*	line;
+	struct timespec timeout;
+	pps_info_t	ppsinfo;
+	int		lines[2];
+	time_f		timef[2];
+	int		i, n;
+
+	for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
+	{
+		if ( line->dev != dev )
+			continue;
+
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = 0;
+
+		if ( time_pps_fetch ( line->ppshandle, PPS_TSFMT_TSPEC, &ppsinfo, &timeout ) == -1 )
+		{
+			loggerf ( LOGGER_NOTE, "ppsfetch failed: %d\n", errno );
+			continue;
+		}
+
+		n = serPpsNewEdges ( line, &ppsinfo, lines, timef );
+		for ( i=0; i<n; i++ )
+		{
+			dev->ppslines = (dev->ppslines & ~line->line) | lines[i];
+
+			if ( serStoreDevStatusLines ( dev, dev->ppslines, timef[i] ) == 1 )
+				dev->changed ( dev );
+		}
+	}
+}
+#endif
+
+#ifdef ENABLE_TIMEPPS_WAIT
+//LinuxPPS can block in time_pps_fetch() until the next edge (even though it doesn't
+//report PPS_CANWAIT) - so wait there rather than checking 100 times/sec.
+//each line has its own thread, as each can have its own pps device
+static void*
+serPpsWaitThread ( void* arg )
+{
+	serLineT*	line = arg;
+	struct timespec timeout;
+	pps_info_t	ppsinfo;
+	serWaitEventT	events[2];
+	int		lines[2];
+	time_f		timef[2];
+	int		i, n;
+
+	while ( 1 )
+	{
+		timeout.tv_sec = 10;
+		timeout.tv_nsec = 0;
+
+		if ( time_pps_fetch ( line->ppshandle, PPS_TSFMT_TSPEC, &ppsinfo, &timeout ) == -1 )
+		{
+			if ( errno == ETIMEDOUT || errno == EINTR )
+				continue;
+
+			loggerf ( LOGGER_NOTE, "ppsfetch failed: %d\n", errno );
+			sleep ( 1 );
+			continue;
+		}
+
+		n = serPpsNewEdges ( line, &ppsinfo, lines, timef );
+		for ( i=0; i<n; i++ )
+		{
+			events[i].mask = line->line;
+			events[i].lines = lines[i];
+			events[i].timef = timef[i];
+			events[i].missedlines = 0;
+			events[i].missed = 0;
+		}
+
+		if ( n > 0 && write ( line->dev->waitpipe[1], events, n*sizeof(events[0]) ) != (ssize_t)(n*sizeof(events[0])) )
+			loggerf ( LOGGER_NOTE, "Error: failed to pass pps event for %s\n", line->dev->dev );
+	}
+
+	return NULL;
+}
+#endif
+
+#endif
+
+
+int
+serStartDev ( serDevT* dev, serChangeT changed )
+{
+#ifdef ENABLE_TIMEPPS_WAIT
+	serLineT*	line;
+#endif
+
+	if ( dev->mode == SERPORT_MODE_REPLAY )
+	{
+		dev->changed = changed;
 		return 0;
 	}
-	if ( lines != dev->curlines )
+
+	if ( dev->modemlines == 0 || dev->fd < 0 )
+		return -1;
+
+	dev->changed = changed;
+
+	if ( glitchWidth > 0 )
+		dev->glitchtimer = evtAddTimer ( serGlitchTimer, dev );
+
+	switch ( dev->mode )
 	{
-		dev->prevlines = dev->curlines;
-		dev->curlines = lines;
-		dev->eventtime = timef;
+	case SERPORT_MODE_POLL:
+		//poll the serial port 1000 times/sec, until the edges are predictable
+		dev->evtsrc = evtAddTimer ( serPollTimer, dev );
+		evtSetTimer ( dev->evtsrc, SERPOLL_UNLOCKED, 0 );
+		return 0;
 
+#ifdef ENABLE_GPIO
+	case SERPORT_MODE_GPIO:
+		//the sysfs value file signals an edge as an exceptional condition
+		dev->evtsrc = evtAddFd ( dev->fd, EVT_PRIORITY, serGpioEvent, dev );
+		if ( dev->evtsrc == NULL )
+			return -1;
+		return 0;
+#endif
+
+#ifdef ENABLE_GPIOCHIP
+	case SERPORT_MODE_GPIOCHIP:
+		dev->evtsrc = evtAddFd ( dev->fd, EVT_READ, serGpioChipEvent, dev );
+		if ( dev->evtsrc == NULL )
+			return -1;
+		return 0;
+#endif
+
+#ifdef ENABLE_TIOCMIWAIT
+	case SERPORT_MODE_IWAIT:
+		if ( serStartWaitPipe ( dev ) < 0 )
+			return -1;
+
+		dev->waittimer = evtAddTimer ( serIwaitTimeout, dev );
+		evtSetTimer ( dev->waittimer, SERIWAIT_TIMEOUT, 0 );
+
+		return serStartWaiter ( dev, &dev->waiter, serIwaitThread, dev );
+#endif
+
+#ifdef ENABLE_TIMEPPS
+	case SERPORT_MODE_TIMEPPS:
+#ifdef ENABLE_TIMEPPS_WAIT
+		if ( serStartWaitPipe ( dev ) < 0 )
+			return -1;
+
+		for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
+		{
+			if ( line->dev == dev && serStartWaiter ( dev, &line->ppswaiter, serPpsWaitThread, line ) < 0 )
+				return -1;
+		}
+		return 0;
+#else
+		//check for a new timestamp 100 times/sec
+		dev->evtsrc = evtAddTimer ( serPpsTimer, dev );
+		evtSetTimer ( dev->evtsrc, 0.01, 0.01 );
+		return 0;
+#endif
+#endif
+
+	}
+
+	loggerf ( LOGGER_NOTE, "Error: serStartDev(): mode not supported\n" );
+
+	//unknown serial port mode !!
+	return -1;
+}
+
+int
+serGetDevStatusLines ( serDevT* dev, time_f timef )
+{
+	int	lines;
+
+#ifdef ENABLE_GPIO
+	char    buf[8];
+	if (dev->mode == SERPORT_MODE_GPIO) {
+		if (lseek(dev->fd, SEEK_SET, 0) == -1)
+			return -1;
+		if (read(dev->fd, buf, sizeof(buf)) <= 0)
+			return -1;
+
+		if (buf[0] == '1')
+			lines = TIOCM_CD;
+		else
+			lines = 0;
+
+		return serStoreDevStatusLines ( dev, lines, timef );
+	}
+#endif
+
+	if ( ioctl ( dev->fd, TIOCMGET, &lines ) != 0 )
+		return -1;
+
+	return serStoreDevStatusLines ( dev, lines, timef );
+}
+
+int
+serStoreDevStatusLines ( serDevT* dev, int lines, time_f timef )
+{
+	serLineT*	line;
+	struct timeval	tv;
+	time_f		seen;
+	int		changed;
+
+	recCaptureLines ( dev, lines, timef );
+
+	//(replayed edges have the capture's times - there's nothing to measure)
+	seen = 0;
+	if ( dev->mode != SERPORT_MODE_REPLAY )
+	{
+		gettimeofday ( &tv, NULL );
+		timeval2time_f ( &tv, seen );
+	}
+
+	//each line is deglitched on its own, so a spike on one can't hide an edge on another
+	changed = 0;
+	for ( line = serGetLine ( NULL ); line != NULL; line = serGetLine ( line ) )
+	{
+		if ( line->dev != dev )
+			continue;
+
+		//(anything pending that held until now first)
+		changed |= serGlitchFlush ( line, timef );
+		changed |= serGlitchEdge ( line, lines & line->line, timef, seen );
+	}
+
+	serGlitchArm ( dev );
+
+	if ( changed )
+	{
+		serGlitchStore ( dev );
 		return 1;
 	}
 
@@ -440,7 +1559,8 @@ serUpdateLinesForDevice ( serDevT* dev )
 		if ( (dev->curlines & line->line) != (dev->prevlines & line->line) )
 		{
 			line->curstate = dev->curlines & line->line;
-			line->eventtime = dev->eventtime;
+			line->eventtime = line->glitchtime;
+			line->seentime = line->glitchseen;
 		}
 	}
 
@@ -5,9 +5,14 @@
 #include <sys/ioctl.h>
 
 #include "timef.h"
+#include "event.h"
 
 #ifdef ENABLE_TIMEPPS
-#include <sys/timepps.h>
+#include "timepps.h"
+#endif
+
+#ifdef ENABLE_WAITTHREAD
+#include <pthread.h>
 #endif
 
 
@@ -17,6 +22,9 @@
 typedef struct serDevS serDevT;
 typedef struct serLineS serLineT;
 
+//called from the event loop when the modem lines on a device have changed
+typedef void (*serChangeT) ( serDevT* dev );
+
 struct serDevS
 {
 	serDevT*	next;
@@ -28,6 +36,8 @@ struct serDevS
 #define	SERPORT_MODE_POLL	(2)
 #define	SERPORT_MODE_TIMEPPS	(3)
 #define SERPORT_MODE_GPIO       (4)
+#define	SERPORT_MODE_GPIOCHIP	(5)
+#define	SERPORT_MODE_REPLAY	(6)	//the changes come from a capture file (see record.h)
 	int		mode;
 
 	//which modem status lines to check - some of TIOCM_{RNG|DSR|CD|CTS}
@@ -38,15 +48,55 @@ struct serDevS
 	//once opened, the fd for this device
 	int		fd;
 #ifdef ENABLE_TIMEPPS
-	pps_handle_t	ppshandle;
-	int		ppslastassert;
-	int		ppslastclear;
+	//the raw line levels from the pps sources on this device
+	int		ppslines;
 #endif
 
-	//the current and previous modem lines active - some of modemlines
+	//SERPORT_MODE_POLL - the phase within the second of each edge is learnt, so once
+	//locked, the port is only polled densely in a window around the expected edges
+#define	SERPOLL_BINS		(200)	//5ms bins
+#define	SERPOLL_UNLOCKED	(0.001)	//uniform polling until locked
+#define	SERPOLL_DENSE		(0.00025)	//inside a window
+#define	SERPOLL_SPARSE		(0.02)	//outside a window - only to notice losing lock
+	unsigned short	pollhist[SERPOLL_BINS];
+	unsigned char	pollwindow[SERPOLL_BINS];
+	int		polledges;
+	int		pollhits;	//edges in a row that fell inside a window
+	int		polllocked;
+
+#ifdef ENABLE_GPIOCHIP
+	//gpio character device - the chip line offset for each line bit (1<<n), the raw
+	//line levels, and the last kernel sequence number seen on each line
+#define	SERGPIO_MAX_LINES	(16)
+#define	SERGPIO_EVENT_BATCH	(16)
+	int		gpiooffsets[SERGPIO_MAX_LINES];
+	int		gpionumlines;
+	int		gpiolines;
+	unsigned int	gpioseqno[SERGPIO_MAX_LINES];
+	int		gpiorealtime;	//kernel timestamps are CLOCK_REALTIME, rather than CLOCK_MONOTONIC
+#endif
+
+	//the current and previous modem lines active (after deglitching) - some of modemlines
 	int		curlines;
 	int		prevlines;
-	time_f		eventtime;
+	time_f		eventtime;	//the latest change passed on
+	evtSourceT*	glitchtimer;	//passes on a change once it has held for glitchWidth
+
+	//-- event loop data
+	serChangeT	changed;
+	evtSourceT*	evtsrc;
+#ifdef ENABLE_WAITTHREAD
+	//TIOCMIWAIT (and a LinuxPPS fetch) blocks, so it runs in its own thread and passes the
+	//lines back through a pipe. (LinuxPPS lines each have their own thread, writing to the same pipe)
+	pthread_t	waiter;
+	int		waitpipe[2];
+	int		waitlines;	//the raw lines passed back so far
+#ifdef ENABLE_TIOCMIWAIT
+	//if nothing happens for a while, the wait is cancelled and restarted
+#define	SERIWAIT_TIMEOUT	(10.0)
+	evtSourceT*	waittimer;
+#endif
+#endif
 
 };
 
@@ -54,17 +104,56 @@ struct serLineS
 {
 	serLineT*	next;
 
-	//one of TIOCM_{RNG|DSR|CD|CTS}
+	//one of TIOCM_{RNG|DSR|CD|CTS} (or a bit for each gpio chip line)
 	int		line;
 	serDevT*	dev;
 
 	int		curstate;
 	time_f		eventtime;
+	time_f		seentime;	//when that change was read (0 if replayed)
+
+	//deglitching - a change in level is only passed on once the new level has held for
+	//glitchWidth (with the time of the change). a change and its reversal inside that are a
+	//spike, and are dropped together. during the first glitchHysteresis after a change, the
+	//line can bounce back without the change losing its time
+	int		glitchraw;	//the raw level
+	time_f		glitchrawtime;	//when the raw level last changed
+	int		glitchstate;	//the level passed on
+	time_f		glitchtime;	//when the level passed on started
+	int		glitchpending;	//the raw level has changed, and not yet held
+	time_f		glitchpendtime;	//when it changed
+	time_f		glitchpendseen;	//when that change was read
+	time_f		glitchseen;	//when the change passed on was read
+	int		glitchmissed;	//edges missed with the pending change - passed on with it
+	time_f		glitchmissedtime;
+	unsigned long	glitchspikes;	//spikes dropped
+	unsigned long	glitchbounces;	//bounces ignored just after a change
+
+	//edges that toggled between two waits, and were never seen - passed on to the clocks
+	//as erasures (cleared once they have been)
+	int		missed;
+	time_f		missedtime;
+
+#ifdef ENABLE_TIMEPPS
+	//each line has its own pps source - either a /dev/ppsN device, or (if ppsdev is empty)
+	//the serial port itself, which can only timestamp DCD
+	char		ppsdev[64];
+	int		ppsfd;
+	pps_handle_t	ppshandle;
+	pps_seq_t	ppslastassert;
+	pps_seq_t	ppslastclear;
+#ifdef ENABLE_TIMEPPS_WAIT
+	pthread_t	ppswaiter;
+#endif
+#endif
 
 };
 
 int serInit (void);
+//line is one of TIOCM_{RNG|DSR|CD|CTS}, or the line offset for SERPORT_MODE_GPIOCHIP
 serLineT* serAddLine ( char* dev, int line, int mode );
+//take the timestamps for a line from a pps device, rather than the serial port (SERPORT_MODE_TIMEPPS)
+int serSetLinePps ( serLineT* line, char* ppsdev );
 
 //pass in NULL to get the first dev/line
 //pass in dev/line to get next dev/line
@@ -74,7 +163,8 @@ serLineT* serGetLine ( serLineT* prev );
 
 
 int serInitHardware ( serDevT* dev );
-int serWaitForSerialChange ( serDevT* dev );
+//add the device to the event loop - changed() is called each time the lines change
+int serStartDev ( serDevT* dev, serChangeT changed );
 
 int serGetDevStatusLines ( serDevT* dev, time_f timef );
 int serStoreDevStatusLines ( serDevT* dev, int lines, time_f time );
@@ -29,4 +29,12 @@
 
 int verboseLevel = 0;
 int debugLevel = 0;
+int gpioDebounceUsec = 0;
+time_f glitchWidth = 0.05;
+time_f glitchHysteresis = 0.0;
+int ppsWindow = 60;
+int shmEverySecond = 0;
+int shmPpsUnit = -1;
+int shmFuseUnit = -1;
+int clockDiscipline = 0;
 
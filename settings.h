@@ -1,6 +1,8 @@
 #ifndef SETTINGS_H_
 #define SETTINGS_H_
 
+#include "timef.h"
+
 
 //run-time settings are externed here..
 //(for compile-time options, see config.h)
@@ -9,5 +11,27 @@ extern int verboseLevel;
 
 extern int debugLevel;
 
+//kernel debounce period for gpio chip lines, in microseconds (0 for none)
+extern int gpioDebounceUsec;
+
+//the shortest level on a line that is passed on to the clocks, and the time after a change
+//for bounces to be ignored in, in seconds (see serLineT)
+extern time_f glitchWidth;
+extern time_f glitchHysteresis;
+
+//how many seconds of pulses are averaged, for the time sent to ntpd
+extern int ppsWindow;
+
+//send every second to each clock's SHM unit, not just each minute - and/or to the SHM units
+//from this one (one for each clock), as a PPS (-1 for none)
+extern int shmEverySecond;
+extern int shmPpsUnit;
+
+//the clocks that agree, combined onto this SHM unit (-1 for none)
+extern int shmFuseUnit;
+
+//steer the kernel clock from the first clock to settle, instead of leaving it to ntpd (-A)
+extern int clockDiscipline;
+
 
 #endif
@@ -34,15 +34,24 @@
 #include "logger.h"
 
 shmTimeT*
-shmCreate ( int unit )
+shmCreate ( int key, int perm )
 {
+	struct shmid_ds	ds;
 	int	shmid;
 	shmTimeT* shm;
 
-	shmid = shmget ( SHM_KEY + unit, sizeof(shmTimeT), IPC_CREAT | 0700 );
+	shmid = shmget ( key, sizeof(shmTimeT), IPC_CREAT | perm );
 	if ( shmid == -1 )
 		return NULL;
 
+	//a unit that's already there keeps the permissions it was made with, unless they're set
+	if ( shmctl ( shmid, IPC_STAT, &ds ) == 0 && ( ds.shm_perm.mode & 0777 ) != perm )
+	{
+		ds.shm_perm.mode = ( ds.shm_perm.mode & ~0777 ) | perm;
+		if ( shmctl ( shmid, IPC_SET, &ds ) < 0 )
+			loggerf ( LOGGER_NOTE, "Error: failed to set the permissions of shared memory key 0x%x to 0%o\n", key, perm );
+	}
+
 	shm = (shmTimeT*) shmat ( shmid, 0, 0 );
 	if ( (shm == (shmTimeT*)-1) || (shm == NULL) )
 		return NULL;
@@ -51,47 +60,89 @@ shmCreate ( int unit )
 }
 
 
+//to the nearest nanosecond
+static void
+shmTimeSpec ( time_f timef, struct timespec* ts )
+{
+	ts->tv_sec = floor ( timef );
+	ts->tv_nsec = floor ( ( timef - ts->tv_sec ) * 1000000000.0 + 0.5 );
+	if ( ts->tv_nsec >= 1000000000 )
+	{
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+//log2 of the error, as a whole number - never better than it is (or than 1ns)
+static int
+shmPrecision ( time_f time_err )
+{
+	if ( time_err < 1e-9 )
+		return -30;
+
+	return (int)ceil ( log ( time_err ) / log ( 2 ) );
+}
+
+//mode 1: a reader takes count before and after reading a sample, and only uses it if count
+//didn't change and valid is set - so the sample's stores have to land between the two
+//increments, as seen from the other cores too (release ordering, with the reader's acquire)
+static void
+shmBegin ( shmTimeT* shm )
+{
+	__atomic_store_n ( &shm->valid, 0, __ATOMIC_RELAXED );
+	__atomic_add_fetch ( &shm->count, 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence ( __ATOMIC_RELEASE );
+}
+
+static void
+shmEnd ( shmTimeT* shm )
+{
+	__atomic_add_fetch ( &shm->count, 1, __ATOMIC_RELEASE );
+	__atomic_store_n ( &shm->valid, 1, __ATOMIC_RELEASE );
+}
+
 void
-shmStore ( shmTimeT* volatile shm, time_f radioclock, time_f localrecv, time_f time_err, int leap )
+shmStore ( shmTimeT* shm, time_f radioclock, time_f localrecv, time_f time_err, int leap )
 {
-	struct timeval radioclocktv,localrecvtv;
+	struct timespec radioclockts,localrecvts;
 
 	loggerf ( LOGGER_DEBUG, "shm: storing time "TIMEF_FORMAT" local "TIMEF_FORMAT" err "TIMEF_FORMAT" leap %d\n", radioclock, localrecv, time_err, leap );
 
-	time_f2timeval ( radioclock, &radioclocktv );
-	time_f2timeval ( localrecv, &localrecvtv );
+	shmTimeSpec ( radioclock, &radioclockts );
+	shmTimeSpec ( localrecv, &localrecvts );
 
-	shm->valid = 0;
+	shmBegin ( shm );
 
 	shm->mode = 1;
-	shm->count++;
-	shm->clockTimeStampSec = radioclocktv.tv_sec;
-	shm->clockTimeStampUSec = radioclocktv.tv_usec;
-	shm->receiveTimeStampSec = localrecvtv.tv_sec;
-	shm->receiveTimeStampUSec = localrecvtv.tv_usec;
+	shm->clockTimeStampSec = radioclockts.tv_sec;
+	shm->clockTimeStampUSec = radioclockts.tv_nsec / 1000;
+	shm->clockTimeStampNSec = radioclockts.tv_nsec;
+	shm->receiveTimeStampSec = localrecvts.tv_sec;
+	shm->receiveTimeStampUSec = localrecvts.tv_nsec / 1000;
+	shm->receiveTimeStampNSec = localrecvts.tv_nsec;
 	shm->leap = leap;
-	shm->precision = log(time_err)/log(2);
-	shm->count++;
+	shm->precision = shmPrecision ( time_err );
 
-	shm->valid = 1;
+	shmEnd ( shm );
 }
 
 void
-shmCheckNoStore ( shmTimeT* volatile shm )
+shmCheckNoStore ( shmTimeT* shm )
 {
-	if ( shm->valid )
+	if ( __atomic_load_n ( &shm->valid, __ATOMIC_ACQUIRE ) )
 		return;
 
+	shmBegin ( shm );
+
 	shm->mode = 1;
-	shm->count++;
 	shm->clockTimeStampSec = 0;
 	shm->clockTimeStampUSec = 0;
+	shm->clockTimeStampNSec = 0;
 	shm->receiveTimeStampSec = 0;
 	shm->receiveTimeStampUSec = 0;
+	shm->receiveTimeStampNSec = 0;
 	shm->leap = LEAP_NOTINSYNC;
 	shm->precision = 0;
-	shm->count++;
 
-	shm->valid = 1;
-	
+	shmEnd ( shm );
 }
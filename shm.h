@@ -5,6 +5,7 @@
 
 // ntpd shared memory reference clock driver structure
 #define SHM_KEY 0x4e545030
+#define SHM_PERM 0700	//the default permissions, for each unit
 typedef struct {
 	int     mode;
 	int     count;
@@ -16,7 +17,9 @@ typedef struct {
 	int     precision;
 	int     nsamples;
 	int     valid;
-	int     dummy[10];
+	unsigned clockTimeStampNSec;	//the nanoseconds, for the ntpd and chrony that read them
+	unsigned receiveTimeStampNSec;
+	int     dummy[8];
 } shmTimeT;
 
 
@@ -27,9 +30,10 @@ typedef struct {
 
 
 
-shmTimeT* shmCreate ( int unit );
-void shmStore ( shmTimeT* volatile shm, time_f radioclock, time_f localrecv, time_f time_err, int leap );
-void shmCheckNoStore ( shmTimeT* volatile shm );
+//key is SHM_KEY + the unit, unless it's been given
+shmTimeT* shmCreate ( int key, int perm );
+void shmStore ( shmTimeT* shm, time_f radioclock, time_f localrecv, time_f time_err, int leap );
+void shmCheckNoStore ( shmTimeT* shm );
 
 
 #endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2002 Jon Atkins http://www.jonatkins.com/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "sock.h"
+#include "timef.h"
+#include "logger.h"
+#include "memory.h"
+
+sockSinkT*
+sockCreate ( const char* path )
+{
+	sockSinkT*	sock;
+
+	if ( strlen ( path ) >= sizeof(sock->addr.sun_path) )
+	{
+		loggerf ( LOGGER_NOTE, "Error: socket path '%s' is too long\n", path );
+		return NULL;
+	}
+
+	sock = safe_mallocz ( sizeof(sockSinkT) );
+
+	//chronyd makes the socket, and may not be running yet - so it's only opened here, and
+	//each sample is sent to the path
+	sock->fd = socket ( AF_UNIX, SOCK_DGRAM, 0 );
+	if ( sock->fd < 0 )
+	{
+		safe_free ( sock );
+		return NULL;
+	}
+	fcntl ( sock->fd, F_SETFD, FD_CLOEXEC );
+
+	sock->addr.sun_family = AF_UNIX;
+	strcpy ( sock->addr.sun_path, path );
+
+	return sock;
+}
+
+int
+sockStore ( sockSinkT* sock, time_f radioclock, time_f localrecv, int leap, int pulse )
+{
+	struct sock_sample	sample;
+
+	loggerf ( LOGGER_DEBUG, "sock: sending time "TIMEF_FORMAT" local "TIMEF_FORMAT" leap %d%s to %s\n", radioclock, localrecv, leap, pulse ? " pulse" : "", sock->addr.sun_path );
+
+	//tv only has microseconds - so the offset is from tv itself, and keeps the rest
+	memset ( &sample, 0, sizeof(sample) );
+	sample.tv.tv_sec = floor ( localrecv );
+	sample.tv.tv_usec = floor ( ( localrecv - sample.tv.tv_sec ) * 1000000.0 );
+	if ( sample.tv.tv_usec >= 1000000 )
+	{
+		sample.tv.tv_sec++;
+		sample.tv.tv_usec -= 1000000;
+	}
+	sample.offset = radioclock - ( sample.tv.tv_sec + sample.tv.tv_usec / 1000000.0 );
+	sample.pulse = pulse;
+	sample.leap = leap;
+	sample.magic = SOCK_MAGIC;
+
+	//never waits - a sample chronyd can't take now is no use to it later
+	if ( sendto ( sock->fd, &sample, sizeof(sample), MSG_DONTWAIT, (struct sockaddr*)&sock->addr, sizeof(sock->addr) ) != sizeof(sample) )
+	{
+		if ( !sock->failed )
+			loggerf ( LOGGER_NOTE, "Error: failed to send to chronyd socket '%s': %s\n", sock->addr.sun_path, strerror ( errno ) );
+		sock->failed = 1;
+		return -1;
+	}
+
+	if ( sock->failed )
+		loggerf ( LOGGER_NOTE, "Sending to chronyd socket '%s' again\n", sock->addr.sun_path );
+	sock->failed = 0;
+
+	return 0;
+}
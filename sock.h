@@ -0,0 +1,33 @@
+#ifndef SOCK_H_
+#define SOCK_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "timef.h"
+
+// chrony SOCK reference clock driver - a datagram to chronyd's socket for each sample
+#define SOCK_MAGIC 0x534f434b
+struct sock_sample {
+	struct timeval	tv;	//the pc time of the sample...
+	double	offset;		//...and the radio time less it
+	int	pulse;		//set if it's only a PPS (the seconds come from another source)
+	int	leap;		//LEAP_NOWARNING, LEAP_ADDSECOND or LEAP_DELSECOND
+	int	_pad;
+	int	magic;		//SOCK_MAGIC
+};
+
+typedef struct {
+	int	fd;
+	struct sockaddr_un	addr;
+	int	failed;		//set while chronyd isn't there, so it's only logged once
+} sockSinkT;
+
+
+//path is the socket chronyd listens on (refclock SOCK path)
+sockSinkT* sockCreate ( const char* path );
+int sockStore ( sockSinkT* sock, time_f radioclock, time_f localrecv, int leap, int pulse );
+
+
+#endif
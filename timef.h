@@ -16,13 +16,8 @@ typedef double time_f;
 #define	time_f2timeval(__timef,__timeval)	do { (__timeval)->tv_sec = floor((__timef)); (__timeval)->tv_usec = ((__timef) - (__timeval)->tv_sec)*1000000.0; } while(0)
 
 
-
-#ifdef ENABLE_TIMEPPS
-
 #define	timespec2time_f(__timeval,__timef)	__timef = (time_f)(__timeval)->tv_sec + (time_f)(__timeval)->tv_nsec / (time_f)1000000000.0
 
 #define	time_f2timespec(__timef,__timeval)	do { (__timeval)->tv_sec = floor((__timef)); (__timeval)->tv_nsec = ((__timef) - (__timeval)->tv_sec)*1000000000.0; } while(0)
 
 #endif
-
-#endif
@@ -0,0 +1,158 @@
+#ifndef TIMEPPS_H_
+#define TIMEPPS_H_
+
+#include "config.h"
+
+//the RFC 2783 pps api - from <sys/timepps.h> where the system has it.
+//on Linux, that header comes with pps-tools (which just wraps the LinuxPPS ioctls), so
+//if it's missing but the kernel headers are there, the same wrappers are provided here.
+
+#if HAVE_SYS_TIMEPPS_H
+
+#include <sys/timepps.h>
+
+#elif HAVE_LINUX_PPS_H
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/pps.h>
+#include "systime.h"
+
+typedef int pps_handle_t;
+typedef unsigned long pps_seq_t;
+
+typedef struct
+{
+	unsigned int	integral;
+	unsigned int	fractional;
+} ntp_fp_t;
+
+typedef union
+{
+	struct timespec	tspec;
+	ntp_fp_t	ntpfp;
+	unsigned long	longpad[3];
+} pps_timeu_t;
+
+typedef struct
+{
+	pps_seq_t	assert_sequence;
+	pps_seq_t	clear_sequence;
+	pps_timeu_t	assert_tu;
+	pps_timeu_t	clear_tu;
+	int		current_mode;
+} pps_info_t;
+
+typedef struct
+{
+	int		api_version;
+	int		mode;
+	pps_timeu_t	assert_off_tu;
+	pps_timeu_t	clear_off_tu;
+} pps_params_t;
+
+#define	assert_timestamp	assert_tu.tspec
+#define	clear_timestamp		clear_tu.tspec
+
+
+static inline int
+time_pps_create ( int source, pps_handle_t* handle )
+{
+	if ( handle == NULL )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	//the handle is just the fd of the /dev/ppsN device
+	*handle = source;
+	return 0;
+}
+
+static inline int
+time_pps_destroy ( pps_handle_t handle )
+{
+	return 0;
+}
+
+static inline int
+time_pps_getparams ( pps_handle_t handle, pps_params_t* ppsparams )
+{
+	struct pps_kparams	kparams;
+
+	if ( ioctl ( handle, PPS_GETPARAMS, &kparams ) < 0 )
+		return -1;
+
+	memset ( ppsparams, 0, sizeof(*ppsparams) );
+	ppsparams->api_version = kparams.api_version;
+	ppsparams->mode = kparams.mode;
+	ppsparams->assert_off_tu.tspec.tv_sec = kparams.assert_off_tu.sec;
+	ppsparams->assert_off_tu.tspec.tv_nsec = kparams.assert_off_tu.nsec;
+	ppsparams->clear_off_tu.tspec.tv_sec = kparams.clear_off_tu.sec;
+	ppsparams->clear_off_tu.tspec.tv_nsec = kparams.clear_off_tu.nsec;
+
+	return 0;
+}
+
+static inline int
+time_pps_setparams ( pps_handle_t handle, const pps_params_t* ppsparams )
+{
+	struct pps_kparams	kparams;
+
+	memset ( &kparams, 0, sizeof(kparams) );
+	kparams.api_version = ppsparams->api_version;
+	kparams.mode = ppsparams->mode;
+	kparams.assert_off_tu.sec = ppsparams->assert_off_tu.tspec.tv_sec;
+	kparams.assert_off_tu.nsec = ppsparams->assert_off_tu.tspec.tv_nsec;
+	kparams.clear_off_tu.sec = ppsparams->clear_off_tu.tspec.tv_sec;
+	kparams.clear_off_tu.nsec = ppsparams->clear_off_tu.tspec.tv_nsec;
+
+	return ioctl ( handle, PPS_SETPARAMS, &kparams );
+}
+
+static inline int
+time_pps_getcap ( pps_handle_t handle, int* mode )
+{
+	return ioctl ( handle, PPS_GETCAP, mode );
+}
+
+//a NULL timeout waits forever, a zero timeout returns straight away
+static inline int
+time_pps_fetch ( pps_handle_t handle, const int tsformat, pps_info_t* ppsinfo, const struct timespec* timeout )
+{
+	struct pps_fdata	fdata;
+
+	if ( tsformat != PPS_TSFMT_TSPEC )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset ( &fdata, 0, sizeof(fdata) );
+	if ( timeout != NULL )
+	{
+		fdata.timeout.sec = timeout->tv_sec;
+		fdata.timeout.nsec = timeout->tv_nsec;
+	}
+	else
+		fdata.timeout.flags = PPS_TIME_INVALID;
+
+	if ( ioctl ( handle, PPS_FETCH, &fdata ) < 0 )
+		return -1;
+
+	memset ( ppsinfo, 0, sizeof(*ppsinfo) );
+	ppsinfo->assert_sequence = fdata.info.assert_sequence;
+	ppsinfo->clear_sequence = fdata.info.clear_sequence;
+	ppsinfo->assert_tu.tspec.tv_sec = fdata.info.assert_tu.sec;
+	ppsinfo->assert_tu.tspec.tv_nsec = fdata.info.assert_tu.nsec;
+	ppsinfo->clear_tu.tspec.tv_sec = fdata.info.clear_tu.sec;
+	ppsinfo->clear_tu.tspec.tv_nsec = fdata.info.clear_tu.nsec;
+	ppsinfo->current_mode = fdata.info.current_mode;
+
+	return 0;
+}
+
+#endif
+
+#endif